@@ -0,0 +1,128 @@
+//invoice and student lookups on a synthetic chain, by full scan and
+//through the ledger index
+//usage: bench_index [invoices] [lookups]
+#define _POSIX_C_SOURCE 200809L
+
+#include "blockchain.h"
+#include "index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+//no proof of work: lookups never look at hashes
+static void build_chain(Blockchain *bc, int invoices) {
+    char id[MAX_INVOICE_ID];
+    memset(bc, 0, sizeof(*bc));
+    bc->block_txs = DEFAULT_BLOCK_TXS;
+    Block *b = block_new(bc->block_txs);
+    if (!b) exit(1);
+    blockchain_push(bc, b);
+
+    //every invoice gets a create and a payment; a third are settled
+    for (int i = 0, k = 0; i < invoices; i++) {
+        for (int e = 0; e < (i % 3 == 0 ? 3 : 2); e++) {
+            Transaction *t = &b->transactions[b->tx_count++];
+            memset(t, 0, sizeof(*t));
+            t->type    = e == 0 ? TX_INVOICE_CREATE :
+                         e == 1 ? TX_PAYMENT_MADE : TX_INVOICE_SETTLE;
+            t->amount  = 1000;
+            t->balance = e == 0 ? 1000 : (i % 3 == 0 ? 0 : 400);
+            snprintf(id, sizeof(id), "STU%06d", i / 4);
+            t->student = str_intern(id);
+            snprintf(id, sizeof(id), "INV%07d", i);
+            t->invoice = str_intern(id);
+            if (b->tx_count == bc->block_txs) {
+                b->block_id = (uint32_t)++k;
+                blockchain_push(bc, b);
+                b->tx_count = 0;
+            }
+        }
+    }
+    if (b->tx_count) blockchain_push(bc, b);
+    free(b);
+}
+
+//returns seconds per lookup; sink keeps the calls from being optimised out
+static double run(const Blockchain *bc, const TxPool *p, int invoices,
+                  int lookups, double *sink) {
+    char   id[MAX_INVOICE_ID];
+    double start = now_seconds();
+    for (int i = 0; i < lookups; i++) {
+        snprintf(id, sizeof(id), "INV%07d",
+                 (int)((unsigned)i * 2654435761u % (unsigned)invoices));
+        *sink += invoice_exists(bc, p, id);
+        *sink += invoice_settled(bc, id);
+        *sink += get_balance(bc, p, id);
+    }
+    return (now_seconds() - start) / lookups;
+}
+
+//student ledgers: four invoices per student
+static double run_students(const Blockchain *bc, const TxPool *p,
+                           int invoices, int lookups, double *sink) {
+    char   id[MAX_STUDENT_ID];
+    int    students = (invoices + 3) / 4;
+    double start    = now_seconds();
+    for (int i = 0; i < lookups; i++) {
+        int64_t outstanding;
+        snprintf(id, sizeof(id), "STU%06d",
+                 (int)((unsigned)i * 2654435761u % (unsigned)students));
+        *sink += student_ledger(bc, p, id, NULL, 0, &outstanding);
+        *sink += (double)outstanding;
+    }
+    return (now_seconds() - start) / lookups;
+}
+
+int main(int argc, char *argv[]) {
+    int invoices = argc > 1 ? atoi(argv[1]) : 100000;
+    int lookups  = argc > 2 ? atoi(argv[2]) : 100000;
+    if (invoices < 1) invoices = 1;
+    if (lookups  < 1) lookups  = 1;
+
+    Blockchain  bc;
+    TxPool      pool;
+    LedgerIndex idx;
+    double      sink = 0;
+
+    pool_init(&pool, 0);
+    build_chain(&bc, invoices);
+    printf("chain: %d blocks, %d invoices\n", bc.length, invoices);
+
+    //a full scan is slow, so it gets a fraction of the lookups
+    int    scans = lookups / 1000 > 0 ? lookups / 1000 : 1;
+    double scan  = run(&bc, &pool, invoices, scans, &sink);
+    double sscan = run_students(&bc, &pool, invoices, scans / 10 + 1, &sink);
+
+    double start = now_seconds();
+    if (!index_init(&idx) || !index_build(&idx, &bc, &pool)) {
+        fprintf(stderr, "Error: out of memory building the index.\n");
+        return 1;
+    }
+    double build   = now_seconds() - start;
+    double indexed = run(&bc, &pool, invoices, lookups, &sink);
+    double sindex  = run_students(&bc, &pool, invoices, lookups, &sink);
+
+    printf("invoice scan    : %10.3f us per lookup (%d lookups)\n",
+           scan * 1e6, scans);
+    printf("invoice indexed : %10.3f us per lookup (%d lookups)\n",
+           indexed * 1e6, lookups);
+    printf("student scan    : %10.3f us per ledger (%d ledgers)\n",
+           sscan * 1e6, scans / 10 + 1);
+    printf("student indexed : %10.3f us per ledger (%d ledgers)\n",
+           sindex * 1e6, lookups);
+    printf("index build: %.3f s, speedup %.0fx (checksum %.0f)\n", build,
+           indexed > 0 ? scan / indexed : 0, sink);
+
+    index_free(&idx);
+    pool_free(&pool);
+    blockchain_free(&bc);
+    str_free_all();
+    return 0;
+}
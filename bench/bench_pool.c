@@ -0,0 +1,86 @@
+//pending pool throughput: queue transactions, then drain them into
+//blocks, with the whole backlog queued at once
+//usage: bench_pool [transactions] [transactions per block]
+#define _POSIX_C_SOURCE 200809L
+
+#include "blockchain.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void fill(TxPool *p, int n) {
+    Transaction tx;
+    char        id[MAX_INVOICE_ID];
+    memset(&tx, 0, sizeof(tx));
+    tx.type = TX_INVOICE_CREATE;
+    for (int i = 0; i < n; i++) {
+        snprintf(id, sizeof(id), "INV%08d", i);
+        tx.invoice = str_intern(id);
+        tx.amount = tx.balance = 1000 + i % 500;
+        if (!pool_add(p, &tx)) exit(1);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (n < 1) n = 1;
+
+    Blockchain bc;
+    TxPool     pool;
+    double     sink = 0;
+
+    //a genesis block for flushed blocks to point at; nothing is mined
+    memset(&bc, 0, sizeof(bc));
+    bc.block_txs = argc > 2 ? atoi(argv[2]) : DEFAULT_BLOCK_TXS;
+    if (bc.block_txs < 1 || bc.block_txs > MAX_BLOCK_TXS)
+        bc.block_txs = DEFAULT_BLOCK_TXS;
+    Block *b = block_new(bc.block_txs);
+    if (!b) return 1;
+    blockchain_push(&bc, b);
+    pool_init(&pool, 0);
+
+    double start = now_seconds();
+    fill(&pool, n);
+    double add = now_seconds() - start;
+
+    //blocks as mining builds them: copy out and merkle root
+    int blocks = 0;
+    start = now_seconds();
+    while (pool_flush_to_block(&pool, b, &bc)) {
+        sink += b->tx_count;
+        blocks++;
+        if (pool.count == 0) break;
+    }
+    double flush = now_seconds() - start;
+
+    //the pool's own share: taking a block's worth off the head
+    fill(&pool, n);
+    start = now_seconds();
+    while (pool.count > 0) {
+        for (int i = 0; i < bc.block_txs && i < pool.count; i++)
+            sink += pool_tx(&pool, i)->amount;
+        pool_discard(&pool, bc.block_txs);
+    }
+    double take = now_seconds() - start;
+
+    printf("queued %d transactions (%d slots, %.1f MB)\n", n, pool.cap,
+           (double)pool.cap * sizeof(Transaction) / (1 << 20));
+    printf("add            : %10.0f tx/s  (%.3f s)\n", n / add, add);
+    printf("flush to block : %10.0f tx/s  (%.3f s, %d blocks of %d)\n",
+           n / flush, flush, blocks, bc.block_txs);
+    printf("take from head : %10.0f tx/s  (%.3f s, checksum %.0f)\n",
+           n / take, take, sink);
+
+    free(b);
+    pool_free(&pool);
+    blockchain_free(&bc);
+    str_free_all();
+    return 0;
+}
@@ -0,0 +1,402 @@
+//the whole pipeline in one run, as JSON on stdout: sha256 throughput,
+//per-nonce header hashing, mining latency by difficulty, chain log and
+//snapshot I/O, full verification and invoice lookups. anything the
+//library prints while it runs goes to /dev/null; progress goes to stderr
+//usage: bench_suite [invoices] [lookups] [max bits]
+#define _POSIX_C_SOURCE 200809L
+
+#include "blockchain.h"
+#include "chainlog.h"
+#include "index.h"
+#include "miner.h"
+#include "sha256.h"
+#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//chain the I/O, verify and query sections run on
+#define CHAIN_BITS  8
+//each timed loop doubles its count until it runs at least this long
+#define MIN_SECONDS 0.2
+
+static FILE *json;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void progress(const char *what) {
+    fprintf(stderr, "bench_suite: %s\n", what);
+}
+
+//seconds per call over calls calls
+static double sha_run(uint8_t *buf, size_t len, int *calls) {
+    char   hex[HASH_HEX_LEN];
+    double t = 0;
+    for (int n = 1;; n *= 2) {
+        double start = now_seconds();
+        for (int i = 0; i < n; i++) {
+            sha256_hex(buf, len, hex);
+            buf[i % len] ^= (uint8_t)hex[0];
+        }
+        t = now_seconds() - start;
+        *calls = n;
+        if (t >= MIN_SECONDS || n >= 1 << 28) break;
+    }
+    return t / *calls;
+}
+
+static void bench_sha256(void) {
+    static const size_t sizes[] = { 64, 256, 1024, 4096, 65536 };
+    uint8_t *buf = malloc(65536);
+    if (!buf) exit(1);
+    for (size_t i = 0; i < 65536; i++) buf[i] = (uint8_t)(i * 131);
+
+    progress("sha256_hex");
+    fprintf(json, "  \"sha256_hex\": [");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int    calls;
+        double per = sha_run(buf, sizes[s], &calls);
+        fprintf(json, "%s\n    {\"bytes\": %zu, \"calls\": %d, "
+                      "\"ns_per_call\": %.1f, \"mb_per_s\": %.1f}",
+                s ? "," : "", sizes[s], calls, per * 1e9,
+                sizes[s] / per / 1e6);
+    }
+    fprintf(json, "\n  ],\n");
+    free(buf);
+}
+
+//a full block whose header is hashed once per nonce, the way the
+//portable miner path does it
+static void bench_header_hash(void) {
+    char   hex[HASH_HEX_LEN];
+    Block *b = block_new(DEFAULT_BLOCK_TXS);
+    if (!b) exit(1);
+    b->tx_count = DEFAULT_BLOCK_TXS;
+    for (int i = 0; i < b->tx_count; i++) {
+        b->transactions[i].type    = TX_INVOICE_CREATE;
+        b->transactions[i].student = str_intern("STU000000");
+        b->transactions[i].invoice = str_intern("INV0000000");
+        b->transactions[i].amount  = 1000 + i;
+    }
+    block_set_merkle_root(b);
+
+    progress("compute_block_hash");
+    double t = 0;
+    int    n = 1;
+    for (;; n *= 2) {
+        double start = now_seconds();
+        for (int i = 0; i < n; i++) {
+            b->nonce++;
+            compute_block_hash(b, hex);
+        }
+        t = now_seconds() - start;
+        if (t >= MIN_SECONDS || n >= 1 << 28) break;
+    }
+    fprintf(json, "  \"compute_block_hash\": {\"calls\": %d, "
+                  "\"ns_per_nonce\": %.1f, \"block_txs\": %d},\n",
+            n, t / n * 1e9, b->tx_count);
+    free(b);
+}
+
+//blocks with a different timestamp each run, so every run searches from
+//a different starting point; the work varies a lot at one difficulty,
+//so low difficulties get more runs
+static void bench_mining(int max_bits) {
+    MinerConfig cfg;
+    uint64_t    hashes = 0;
+    char        what[64];
+    Block      *b = block_new(DEFAULT_BLOCK_TXS);
+    if (!b) exit(1);
+    miner_config_default(&cfg);
+    cfg.quiet  = 1;
+    cfg.report = 0;
+    cfg.hashes = &hashes;
+    miner_set_config(&cfg);
+
+    fprintf(json, "  \"mine_block\": {\"threads\": %d, \"runs\": [",
+            miner_thread_count(&cfg));
+    for (int bits = 8, first = 1; bits <= max_bits; bits += 4, first = 0) {
+        int    runs = bits <= 12 ? 32 : bits <= 16 ? 8 : 3;
+        double total = 0, worst = 0;
+        snprintf(what, sizeof(what), "mine_block at %d bits", bits);
+        progress(what);
+        hashes = 0;
+        for (int r = 0; r < runs; r++) {
+            b->block_id    = (uint32_t)r;
+            b->timestamp   = (int64_t)time(NULL) + r;
+            b->target_bits = (uint32_t)bits;
+            b->nonce       = 0;
+            block_set_merkle_root(b);
+            double start = now_seconds();
+            mine_block(b, bits);
+            double t = now_seconds() - start;
+            total += t;
+            if (t > worst) worst = t;
+        }
+        fprintf(json, "%s\n    {\"bits\": %d, \"runs\": %d, "
+                      "\"mean_ms\": %.3f, \"max_ms\": %.3f, "
+                      "\"hashes_per_s\": %.0f}",
+                first ? "" : ",", bits, runs, total / runs * 1e3,
+                worst * 1e3, total > 0 ? (double)hashes / total : 0);
+    }
+    fprintf(json, "\n  ]},\n");
+
+    cfg.hashes = NULL;
+    miner_set_config(&cfg);
+    free(b);
+}
+
+//a real chain at CHAIN_BITS: every invoice is created, and two in three
+//get a payment, through the pool and the miner like ingest does
+static void build_chain(Blockchain *bc, int invoices) {
+    TxPool      pool;
+    Transaction tx;
+    char        id[MAX_INVOICE_ID];
+    MinerConfig cfg;
+
+    miner_config_default(&cfg);
+    cfg.threads = 1;
+    cfg.quiet   = 1;
+    cfg.report  = 0;
+    miner_set_config(&cfg);
+
+    blockchain_init(bc, CHAIN_BITS);
+    pool_init(&pool, 0);
+    Block *b = block_new(bc->block_txs);
+    if (!b) exit(1);
+
+    for (int i = 0; i < invoices; i++) {
+        memset(&tx, 0, sizeof(tx));
+        snprintf(id, sizeof(id), "STU%06d", i / 4);
+        tx.student = str_intern(id);
+        snprintf(id, sizeof(id), "INV%07d", i);
+        tx.invoice    = str_intern(id);
+        tx.type       = TX_INVOICE_CREATE;
+        tx.amount     = tx.balance = 100000;
+        tx.event_time = (int64_t)time(NULL);
+        if (!pool_add(&pool, &tx)) exit(1);
+        if (i % 3 != 2) {
+            tx.type    = TX_PAYMENT_MADE;
+            tx.amount  = i % 3 == 0 ? 100000 : 40000;
+            tx.balance = 100000 - tx.amount;
+            snprintf(id, sizeof(id), "PAY%07d", i);
+            tx.reference = str_intern(id);
+            if (!pool_add(&pool, &tx)) exit(1);
+        }
+        while (pool.count >= bc->block_txs ||
+               (i == invoices - 1 && pool.count > 0)) {
+            pool_flush_to_block(&pool, b, bc);
+            mine_block(b, (int)b->target_bits);
+            if (!blockchain_add_mined_block(bc, b)) exit(1);
+        }
+    }
+    free(b);
+    pool_free(&pool);
+}
+
+//seconds per lookup of a spread of invoice ids
+static double lookup_run(const Blockchain *bc, const TxPool *p, int invoices,
+                         int lookups, int balance, double *sink) {
+    char   id[MAX_INVOICE_ID];
+    double start = now_seconds();
+    for (int i = 0; i < lookups; i++) {
+        snprintf(id, sizeof(id), "INV%07d",
+                 (int)((unsigned)i * 2654435761u % (unsigned)invoices));
+        *sink += balance ? (double)get_balance(bc, p, id)
+                         : invoice_exists(bc, p, id);
+    }
+    return (now_seconds() - start) / lookups;
+}
+
+static void bench_queries(Blockchain *bc, int invoices, int lookups) {
+    TxPool      pool;
+    LedgerIndex idx;
+    double      sink  = 0;
+    //a full scan is slow, so it gets a fraction of the lookups
+    int         scans = lookups / 1000 > 0 ? lookups / 1000 : 1;
+
+    progress("lookups");
+    pool_init(&pool, 0);
+    double exists_scan  = lookup_run(bc, &pool, invoices, scans, 0, &sink);
+    double balance_scan = lookup_run(bc, &pool, invoices, scans, 1, &sink);
+
+    double start = now_seconds();
+    if (!index_init(&idx) || !index_build(&idx, bc, &pool)) {
+        fprintf(stderr, "Error: out of memory building the index.\n");
+        exit(1);
+    }
+    double build = now_seconds() - start;
+    double exists_idx  = lookup_run(bc, &pool, invoices, lookups, 0, &sink);
+    double balance_idx = lookup_run(bc, &pool, invoices, lookups, 1, &sink);
+
+    fprintf(json, "  \"queries\": {\"scan_lookups\": %d, "
+                  "\"indexed_lookups\": %d, \"index_build_s\": %.6f,\n"
+                  "    \"invoice_exists_us\": {\"scan\": %.3f, "
+                  "\"indexed\": %.3f},\n"
+                  "    \"get_balance_us\": {\"scan\": %.3f, "
+                  "\"indexed\": %.3f},\n"
+                  "    \"checksum\": %.0f},\n",
+            scans, lookups, build, exists_scan * 1e6, exists_idx * 1e6,
+            balance_scan * 1e6, balance_idx * 1e6, sink);
+
+    bc->index = NULL;
+    index_free(&idx);
+    pool_free(&pool);
+}
+
+static void bench_verify(const Blockchain *bc) {
+    progress("blockchain_verify");
+    double start = now_seconds();
+    int    ok    = blockchain_verify(bc, NULL, 1);
+    double t     = now_seconds() - start;
+    fprintf(json, "  \"verify\": {\"valid\": %s, \"full_s\": %.6f, "
+                  "\"us_per_block\": %.3f},\n",
+            ok ? "true" : "false", t, t / bc->length * 1e6);
+}
+
+static long file_size(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fclose(f);
+    return n;
+}
+
+//what replaced save/load: the chain log written whole, opened by reading
+//every record and by mapping it, grown block by block; then the state
+//snapshot. the snapshot is read back last, as at startup, into an empty
+//string table; it restores every handle the chain uses, so bc stays good
+static void bench_io(const Blockchain *bc, const char *dir) {
+    ChainLog   log;
+    Blockchain copy;
+    Snapshot   snap;
+    LedgerIndex idx;
+    char       path[256], snap_path[256];
+    snprintf(path, sizeof(path), "%s/chain.log", dir);
+    snprintf(snap_path, sizeof(snap_path), "%s/state.snap", dir);
+
+    progress("chain log and snapshot");
+    double start = now_seconds();
+    if (!chainlog_create(&log, path, bc, DEFAULT_SYNC_MS)) exit(1);
+    chainlog_close(&log);
+    double create = now_seconds() - start;
+    long   bytes  = file_size(path);
+
+    start = now_seconds();
+    if (chainlog_open(&log, path, &copy, DEFAULT_SYNC_MS, 0, 0) != 1)
+        exit(1);
+    double opened = now_seconds() - start;
+    chainlog_close(&log);
+    blockchain_free(&copy);
+
+    //the offset index was written by create, so this maps
+    start = now_seconds();
+    if (chainlog_open(&log, path, &copy, DEFAULT_SYNC_MS, 1, 0) != 1)
+        exit(1);
+    double mapped = now_seconds() - start;
+    blockchain_free(&copy);
+    chainlog_close(&log);
+
+    //a log holding the genesis block only, then the rest appended. the
+    //copy shares bc's blocks and is only read up to its length
+    Blockchain genesis = *bc;
+    genesis.length = 1;
+    genesis.index  = NULL;
+    if (!chainlog_create(&log, path, &genesis, DEFAULT_SYNC_MS)) exit(1);
+    start = now_seconds();
+    for (int i = 1; i < bc->length; i++)
+        if (!chainlog_append(&log, blockchain_block(bc, i))) exit(1);
+    chainlog_close(&log);
+    double append = now_seconds() - start;
+
+    start = now_seconds();
+    if (!snapshot_save(bc, snap_path)) exit(1);
+    double snap_save  = now_seconds() - start;
+    long   snap_bytes = file_size(snap_path);
+
+    str_free_all();
+    start = now_seconds();
+    if (!snapshot_load(&snap, &idx, snap_path)) exit(1);
+    double snap_load = now_seconds() - start;
+    index_free(&idx);
+
+    fprintf(json, "  \"io\": {\"chain_log_bytes\": %ld, "
+                  "\"snapshot_bytes\": %ld, \"sync_ms\": %d,\n"
+                  "    \"chainlog_create_s\": %.6f, "
+                  "\"chainlog_open_read_s\": %.6f, "
+                  "\"chainlog_open_mapped_s\": %.6f,\n"
+                  "    \"chainlog_append_us_per_block\": %.3f, "
+                  "\"snapshot_save_s\": %.6f, \"snapshot_load_s\": %.6f}\n",
+            bytes, snap_bytes, DEFAULT_SYNC_MS, create, opened, mapped,
+            append / (bc->length - 1) * 1e6, snap_save, snap_load);
+
+    remove(path);
+    snprintf(path, sizeof(path), "%s/chain.log.idx", dir);
+    remove(path);
+    remove(snap_path);
+    rmdir(dir);
+}
+
+int main(int argc, char *argv[]) {
+    int invoices = argc > 1 ? atoi(argv[1]) : 100000;
+    int lookups  = argc > 2 ? atoi(argv[2]) : 100000;
+    int max_bits = argc > 3 ? atoi(argv[3]) : 20;
+    if (invoices < 1) invoices = 1;
+    if (lookups  < 1) lookups  = 1;
+    if (max_bits < 8) max_bits = 8;
+    if (max_bits > 32) max_bits = 32;
+
+    char dir[] = "/tmp/bench_suite.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    //the results keep the real stdout, everything else printed there
+    //(verify's report, mining output) is dropped
+    fflush(stdout);
+    int out  = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    json = out >= 0 ? fdopen(out, "w") : NULL;
+    if (!json || null < 0 || dup2(null, STDOUT_FILENO) < 0) {
+        perror("bench_suite");
+        return 1;
+    }
+    close(null);
+
+    fprintf(json, "{\n  \"sha256_impl\": \"%s\", \"sha256_x8_impl\": "
+                  "\"%s\",\n",
+            sha256_impl(), sha256_x8_impl());
+    bench_sha256();
+    bench_header_hash();
+    bench_mining(max_bits);
+
+    Blockchain bc;
+    progress("building the chain");
+    double start = now_seconds();
+    build_chain(&bc, invoices);
+    double build = now_seconds() - start;
+    int    txs   = 0;
+    for (int i = 0; i < bc.length; i++)
+        txs += blockchain_block(&bc, i)->tx_count;
+    fprintf(json, "  \"chain\": {\"invoices\": %d, \"blocks\": %d, "
+                  "\"transactions\": %d, \"bits\": %d, \"build_s\": %.3f},\n",
+            invoices, bc.length, txs, CHAIN_BITS, build);
+
+    bench_queries(&bc, invoices, lookups);
+    bench_verify(&bc);
+    bench_io(&bc, dir);
+    fprintf(json, "}\n");
+
+    blockchain_free(&bc);
+    str_free_all();
+    return fclose(json) == 0 ? 0 : 1;
+}
@@ -6,15 +6,37 @@
 
 #include "blockchain.h"
 #include "sha256.h"
+#include "miner.h"
+#include "chainlog.h"
+#include "index.h"
+#include "merkle.h"
+#include "ingest.h"
+#include "bgminer.h"
+#include "snapshot.h"
+#include "stats.h"
 
 //file paths
+#define CHAIN_LOG    "data/chain.log"
+#define PENDING_LOG  "data/pending.wal"
+#define CHECKPOINT   "data/chain.verified"
+#define STATE_SNAP   "data/state.snap"
+#define STATS_FILE   "data/stats.json"
+//snapshot files from before the logs, imported once if no log exists yet
 #define CHAIN_FILE   "data/chain.bin"
 #define PENDING_FILE "data/pending.bin"
-#define DIFF_FILE    "data/difficulty.txt"
 
 //global state
 static Blockchain bc;
 static TxPool     pool;
+static ChainLog   chain_log;
+static PoolLog    pool_log;
+static LedgerIndex ledger_index;
+//mines in the background; the menu holds its lock while running a command
+static BgMiner    miner;
+//rewrites STATE_SNAP as the chain grows; snap_height is where the one on
+//disk was taken
+static Snapshotter snapshotter;
+static int         snap_height;
 
 //helper: safe line input
 static void read_line(const char *prompt, char *buf, int size) {
@@ -31,39 +53,127 @@ static void read_line(const char *prompt, char *buf, int size) {
 }
 
 //persistence helpers
-static void save_all(void) {
-    blockchain_save(&bc, CHAIN_FILE);
 
-    //save pending pol
-    FILE *f = fopen(PENDING_FILE, "wb");
-    if (f) {
-        fwrite(&pool.count, sizeof(int), 1, f);
-        fwrite(pool.txs, sizeof(Transaction), pool.count, f);
-        fclose(f);
+//queue a transaction in the pool and its write-ahead log; a full pool
+//holds it back until the miner has added a block to make room
+static int queue_tx(Transaction *tx) {
+    while (pool_full(&pool)) {
+        printf("  [*] Pending pool is full (%d); waiting for the miner.\n",
+               pool.limit);
+        if (!bgminer_request(&miner) || !bgminer_wait(&miner)) {
+            printf("  [!] No block could be mined; transaction not "
+                   "queued.\n");
+            return 0;
+        }
     }
+    if (!pool_add(&pool, tx)) return 0;
+    poollog_add(&pool_log, tx);
+    bgminer_queued(&miner);
+    return 1;
 }
 
-static void load_all(int default_difficulty) {
-    //try to load existin chain
-    if (!blockchain_load(&bc, CHAIN_FILE)) {
-        printf("No existing chain found. Initialising genesis block...\n");
-        blockchain_init(&bc, default_difficulty);
-        save_all();
-    }
-
-    //load pendin pool
-    pool_init(&pool);
+//pending.bin, from before the pool log: a count, then that many WideTx
+static void load_legacy_pool(void) {
     FILE *f = fopen(PENDING_FILE, "rb");
     if (f) {
-        int count = 0;
+        int         count = 0;
+        WideTx      w;
+        Transaction tx;
         fread(&count, sizeof(int), 1, f);
-        if (count > MAX_PENDING) count = MAX_PENDING;
-        fread(pool.txs, sizeof(Transaction), count, f);
-        pool.count = count;
+        for (int i = 0; i < count; i++) {
+            if (fread(&w, sizeof(w), 1, f) != 1) break;
+            tx_from_wide(&tx, &w);
+            if (!pool_add(&pool, &tx)) break;
+        }
         fclose(f);
     }
 }
 
+static void load_all(int default_difficulty, int block_time, int window,
+                     int block_txs, int sync_ms, int mapped, int pool_limit) {
+    pool_init(&pool, pool_limit);
+
+    //try to load existin chain, with the index and the strings of the
+    //blocks the state snapshot covers taken from the snapshot
+    Snapshot snap;
+    int      snapped = snapshot_load(&snap, &ledger_index, STATE_SNAP);
+    int      loaded  = chainlog_open(&chain_log, CHAIN_LOG, &bc, sync_ms,
+                                     mapped, snapped ? snap.height : 0);
+    if (snapped && (loaded != 1 || !snapshot_matches(&snap, &bc))) {
+        //taken from another chain, or the chain was cut short since
+        if (loaded == 1) {
+            printf("%s does not match the chain; indexing every block.\n",
+                   STATE_SNAP);
+            remove(STATE_SNAP);
+            chainlog_close(&chain_log);
+            blockchain_free(&bc);
+        }
+        index_free(&ledger_index);
+        str_free_all();
+        snapped = 0;
+        loaded  = chainlog_open(&chain_log, CHAIN_LOG, &bc, sync_ms, mapped,
+                                0);
+    }
+    snap_height = snapped ? snap.height : 0;
+    if (loaded < 0) {
+        fprintf(stderr, "Error: %s is not in a supported chain format.\n"
+                        "Move it aside to start a new chain.\n", CHAIN_LOG);
+        exit(1);
+    }
+    if (!loaded) {
+        int legacy = blockchain_load(&bc, CHAIN_FILE);
+        if (legacy < 0) {
+            fprintf(stderr, "Error: %s is not in a supported chain format.\n"
+                            "Move it aside to start a new chain.\n",
+                    CHAIN_FILE);
+            exit(1);
+        }
+        if (legacy) {
+            printf("Importing %s into %s...\n", CHAIN_FILE, CHAIN_LOG);
+            if (mine_reseal_chain(&bc) < 0) {
+                fprintf(stderr, "Error: out of memory importing %s.\n",
+                        CHAIN_FILE);
+                exit(1);
+            }
+            load_legacy_pool();
+        } else {
+            printf("No existing chain found. Initialising genesis block...\n");
+            blockchain_init(&bc, default_difficulty);
+            blockchain_set_retarget(&bc, block_time, window);
+            blockchain_set_block_txs(&bc, block_txs);
+        }
+        if (!chainlog_create(&chain_log, CHAIN_LOG, &bc, sync_ms)) exit(1);
+    }
+
+    //load pendin pool
+    if (!poollog_open(&pool_log, PENDING_LOG, &pool, &bc, sync_ms)) exit(1);
+
+    //invoice lookups go through the index from here on
+    if (snapped ? !index_build_from(&ledger_index, &bc, &pool, snap_height)
+                : !index_init(&ledger_index) ||
+                  !index_build(&ledger_index, &bc, &pool))
+        fprintf(stderr, "Warning: out of memory indexing invoices; "
+                        "lookups will scan the chain.\n");
+}
+
+static void close_all(void) {
+    snapshotter_stop(&snapshotter);
+    int cancelled = bgminer_stop(&miner);
+    if (cancelled)
+        printf("Mining stopped; %d transaction(s) stay pending.\n",
+               cancelled);
+#if ALU_STATS
+    //the session's counters, once nothing is adding to them
+    stats_write_json(STATS_FILE);
+#endif
+    poollog_close(&pool_log);
+    chainlog_close(&chain_log);
+    blockchain_free(&bc);
+    pool_free(&pool);
+    index_free(&ledger_index);
+    str_free_all();
+}
+
 //CLI handlers
 
 static void cmd_invoice_create(void) {
@@ -71,7 +181,8 @@ static void cmd_invoice_create(void) {
     char invoice_id[MAX_INVOICE_ID];
     char amount_str[32];
     char note[MAX_REF];
-    double amount;
+    char amt[MONEY_STR_LEN];
+    int64_t amount;
 
     printf("\n--- Create Invoice ---\n");
 
@@ -89,7 +200,10 @@ static void cmd_invoice_create(void) {
             printf("  [!] Invalid invoice ID.\n");
             continue;
         }
-        if (invoice_exists(&bc, &pool, invoice_id)) {
+        bgminer_lock(&miner);
+        int taken = invoice_exists(&bc, &pool, invoice_id);
+        bgminer_unlock(&miner);
+        if (taken) {
             printf("  [!] Invoice ID already exists. Choose another.\n");
             invoice_id[0] = '\0';
         }
@@ -98,14 +212,16 @@ static void cmd_invoice_create(void) {
     //Amount
     do {
         read_line("  Total Amount (RWF): ", amount_str, sizeof(amount_str));
-        amount = atof(amount_str);
+        if (!parse_amount(amount_str, &amount)) amount = 0;
         if (!validate_amount(amount))
-            printf("  [!] Amount must be positive.\n");
+            printf("  [!] Amount must be positive, with at most 2 "
+                   "decimals.\n");
     } while (!validate_amount(amount));
 
     read_line("  Note/Description: ", note, sizeof(note));
     if (strlen(note) == 0) strncpy(note, "ALU Tuition Invoice", sizeof(note)-1);
 
+    bgminer_lock(&miner);
     Transaction tx;
     memset(&tx, 0, sizeof(tx));
     tx.type       = TX_INVOICE_CREATE;
@@ -113,23 +229,24 @@ static void cmd_invoice_create(void) {
     tx.amount     = amount;
     tx.balance    = amount;
     tx.confirmed  = 1;
-    strncpy(tx.student_id, student_id, MAX_STUDENT_ID - 1);
-    strncpy(tx.invoice_id, invoice_id, MAX_INVOICE_ID - 1);
-    strncpy(tx.reference,  note,       MAX_REF - 1);
-
-    if (pool_add(&pool, &tx)) {
-        save_all();
-        printf("  [OK] Invoice %s created for student %s — %.2f RWF\n",
-               invoice_id, student_id, amount);
+    tx.student    = str_intern(student_id);
+    tx.invoice    = str_intern(invoice_id);
+    tx.reference  = str_intern(note);
+
+    if (queue_tx(&tx)) {
+        printf("  [OK] Invoice %s created for student %s — %s RWF\n",
+               invoice_id, student_id, format_amount(amount, amt));
         printf("  [*] Pending — run 'mine' to commit to blockchain.\n");
     }
+    bgminer_unlock(&miner);
 }
 
 static void cmd_payment_record(void) {
     char invoice_id[MAX_INVOICE_ID];
     char amount_str[32];
     char ref[MAX_REF];
-    double pay_amount;
+    char amt[MONEY_STR_LEN], bal[MONEY_STR_LEN];
+    int64_t pay_amount;
 
     printf("\n--- Record Payment ---\n");
 
@@ -139,35 +256,49 @@ static void cmd_payment_record(void) {
             printf("  [!] Invalid invoice ID.\n");
             continue;
         }
-        if (!invoice_exists(&bc, &pool, invoice_id)) {
+        bgminer_lock(&miner);
+        int exists  = invoice_exists(&bc, &pool, invoice_id);
+        int settled = exists && invoice_settled(&bc, invoice_id);
+        bgminer_unlock(&miner);
+        if (!exists) {
             printf("  [!] Invoice not found.\n");
             invoice_id[0] = '\0';
-        } else if (invoice_settled(&bc, invoice_id)) {
+        } else if (settled) {
             printf("  [!] Invoice is already fully settled.\n");
             return;
         }
     } while (!validate_invoice_id(invoice_id) || invoice_id[0] == '\0');
 
-    double current_balance = get_balance(&bc, &pool, invoice_id);
-    printf("  Current outstanding balance: %.2f RWF\n", current_balance);
+    //only this thread queues transactions, so the balance holds while the
+    //amount is typed in; the miner just moves them into the chain
+    InvoiceState inv;
+    bgminer_lock(&miner);
+    invoice_state(&bc, &pool, str_find(invoice_id), &inv);
+    bgminer_unlock(&miner);
+    int64_t current_balance = inv.balance;
+    printf("  Current outstanding balance: %s RWF\n",
+           format_amount(current_balance, bal));
 
     do {
         read_line("  Payment Amount (RWF): ", amount_str, sizeof(amount_str));
-        pay_amount = atof(amount_str);
-        if (!validate_amount(pay_amount))
-            printf("  [!] Amount must be positive.\n");
-        else if (pay_amount > current_balance + 0.001) {
-            printf("  [!] Payment (%.2f) exceeds balance (%.2f).\n",
-                   pay_amount, current_balance);
-            pay_amount = -1;
+        if (!parse_amount(amount_str, &pay_amount)) pay_amount = 0;
+        if (!validate_amount(pay_amount)) {
+            printf("  [!] Amount must be positive, with at most 2 "
+                   "decimals.\n");
+            pay_amount = 0;
+        } else if (pay_amount > current_balance) {
+            printf("  [!] Payment (%s) exceeds balance (%s).\n",
+                   format_amount(pay_amount, amt), bal);
+            pay_amount = 0;
         }
     } while (pay_amount <= 0);
 
     read_line("  Payment Reference: ", ref, sizeof(ref));
     if (strlen(ref) == 0) strncpy(ref, "PAYMENT", sizeof(ref)-1);
 
-    double new_balance = current_balance - pay_amount;
+    int64_t new_balance = current_balance - pay_amount;
 
+    bgminer_lock(&miner);
     Transaction tx;
     memset(&tx, 0, sizeof(tx));
     tx.type       = TX_PAYMENT_MADE;
@@ -175,29 +306,18 @@ static void cmd_payment_record(void) {
     tx.amount     = pay_amount;
     tx.balance    = new_balance;
     tx.confirmed  = 0;   //awaiting confirmation
-    strncpy(tx.invoice_id, invoice_id, MAX_INVOICE_ID - 1);
-    strncpy(tx.reference,  ref,        MAX_REF - 1);
-
-    //Copy student_id from the invoice creation record
-    for (int i = 0; i < bc.length; i++)
-        for (int j = 0; j < bc.blocks[i].tx_count; j++)
-            if (bc.blocks[i].transactions[j].type == TX_INVOICE_CREATE &&
-                strcmp(bc.blocks[i].transactions[j].invoice_id, invoice_id) == 0)
-                strncpy(tx.student_id,
-                        bc.blocks[i].transactions[j].student_id,
-                        MAX_STUDENT_ID - 1);
-    for (int i = 0; i < pool.count; i++)
-        if (pool.txs[i].type == TX_INVOICE_CREATE &&
-            strcmp(pool.txs[i].invoice_id, invoice_id) == 0)
-            strncpy(tx.student_id, pool.txs[i].student_id, MAX_STUDENT_ID - 1);
-
-    if (pool_add(&pool, &tx)) {
-        save_all();
-        printf("  [OK] Payment of %.2f RWF recorded (ref: %s).\n",
-               pay_amount, ref);
-        printf("  [*] Remaining balance: %.2f RWF\n", new_balance);
+    tx.invoice    = str_find(invoice_id);
+    tx.student    = inv.student;   //from the invoice creation record
+    tx.reference  = str_intern(ref);
+
+    if (queue_tx(&tx)) {
+        printf("  [OK] Payment of %s RWF recorded (ref: %s).\n",
+               format_amount(pay_amount, amt), ref);
+        printf("  [*] Remaining balance: %s RWF\n",
+               format_amount(new_balance, bal));
         printf("  [*] Pending confirmation — run 'mine' then 'payment confirm'.\n");
     }
+    bgminer_unlock(&miner);
 }
 
 static void cmd_payment_confirm(void) {
@@ -212,47 +332,82 @@ static void cmd_payment_confirm(void) {
         }
     } while (!validate_invoice_id(invoice_id) || invoice_id[0] == '\0');
 
-    //Find the most recent unconfirmed PAYMENT_MADE in the chain
-    int found = 0;
-    for (int i = bc.length - 1; i >= 0 && !found; i--) {
-        for (int j = bc.blocks[i].tx_count - 1; j >= 0 && !found; j--) {
-            Transaction *t = &bc.blocks[i].transactions[j];
-            if (t->type == TX_PAYMENT_MADE &&
-                !t->confirmed &&
-                strcmp(t->invoice_id, invoice_id) == 0) {
-
-                t->confirmed = 1;
-                found = 1;
-                printf("  [OK] Payment for invoice %s confirmed (block %u).\n",
-                       invoice_id, bc.blocks[i].block_id);
-
-                //If balance == 0, automatically add settlement tx
-                if (t->balance < 0.005) {
-                    Transaction settle;
-                    memset(&settle, 0, sizeof(settle));
-                    settle.type       = TX_INVOICE_SETTLE;
-                    settle.event_time = time(NULL);
-                    settle.amount     = 0;
-                    settle.balance    = 0;
-                    settle.confirmed  = 1;
-                    strncpy(settle.invoice_id, invoice_id, MAX_INVOICE_ID - 1);
-                    strncpy(settle.student_id, t->student_id, MAX_STUDENT_ID - 1);
-                    strncpy(settle.reference, "AUTO-SETTLE", MAX_REF - 1);
-                    pool_add(&pool, &settle);
-                    printf("  [*] Balance cleared — settlement event queued.\n");
-                    printf("  [*] Run 'mine' to commit settlement.\n");
-                }
+    bgminer_lock(&miner);
+    //Find the most recent unconfirmed PAYMENT_MADE in the chain or in the
+    //block being mined; neither can be changed any more, so the
+    //confirmation is queued as its own event
+    int                found = 0;
+    int                height, pay_height = 0;
+    int                inflight = bgminer_inflight(&miner);
+    StrId              invoice  = str_find(invoice_id);
+    const Transaction *t, *pay = NULL;
+    EventCursor        cur;
+    invoice_events_begin(&cur, &bc, NULL, invoice);
+    while ((t = invoice_events_next(&cur, &height)) != NULL)
+        if (t->type == TX_PAYMENT_MADE &&
+            !payment_is_confirmed(&bc, &pool, t)) {
+            pay        = t;
+            pay_height = height;
+        }
+    for (int i = 0; i < inflight; i++) {
+        t = pool_tx(&pool, i);
+        if (t->type == TX_PAYMENT_MADE && t->invoice == invoice &&
+            !payment_is_confirmed(&bc, &pool, t)) {
+            pay        = t;
+            pay_height = INDEX_POOL;
+        }
+    }
+
+    if (pay) {
+        found = 1;
+        //queue_tx may wait for the miner, which moves pool entries
+        Transaction paid = *pay;
+        pay = &paid;
+        uint32_t block_id = pay_height == INDEX_POOL
+                          ? (uint32_t)bc.length
+                          : blockchain_block(&bc, pay_height)->block_id;
+        Transaction conf;
+        memset(&conf, 0, sizeof(conf));
+        conf.type       = TX_PAYMENT_CONFIRM;
+        conf.event_time = time(NULL);
+        conf.amount     = pay->amount;
+        conf.balance    = pay->balance;
+        conf.confirmed  = 1;
+        conf.invoice    = invoice;
+        conf.student    = pay->student;
+        conf.reference  = pay->reference;
+        if (queue_tx(&conf)) {
+            printf("  [OK] Payment for invoice %s confirmed (block %u%s).\n",
+                   invoice_id, block_id,
+                   pay_height == INDEX_POOL ? ", being mined" : "");
+
+            //If balance == 0, automatically add settlement tx
+            if (pay->balance == 0) {
+                Transaction settle;
+                memset(&settle, 0, sizeof(settle));
+                settle.type       = TX_INVOICE_SETTLE;
+                settle.event_time = time(NULL);
+                settle.amount     = 0;
+                settle.balance    = 0;
+                settle.confirmed  = 1;
+                settle.invoice    = invoice;
+                settle.student    = pay->student;
+                settle.reference  = str_intern("AUTO-SETTLE");
+                queue_tx(&settle);
+                printf("  [*] Balance cleared — settlement event queued.\n");
             }
+            printf("  [*] Run 'mine' to commit the confirmation.\n");
         }
     }
 
-    //Also search the pending pool
-    for (int i = 0; i < pool.count && !found; i++) {
-        Transaction *t = &pool.txs[i];
-        if (t->type == TX_PAYMENT_MADE &&
-            !t->confirmed &&
-            strcmp(t->invoice_id, invoice_id) == 0) {
-            t->confirmed = 1;
+    //Also search the rest of the pending pool
+    for (int i = inflight; i < pool.count && !found; i++) {
+        Transaction *pt = pool_tx(&pool, i);
+        if (pt->type == TX_PAYMENT_MADE &&
+            !pt->confirmed &&
+            pt->invoice == invoice) {
+            pt->confirmed = 1;
+            poollog_confirm(&pool_log, i);
             found = 1;
             printf("  [OK] Pending payment for invoice %s confirmed.\n",
                    invoice_id);
@@ -262,8 +417,7 @@ static void cmd_payment_confirm(void) {
     if (!found)
         printf("  [!] No unconfirmed payment found for invoice %s.\n",
                invoice_id);
-
-    save_all();
+    bgminer_unlock(&miner);
 }
 
 static void cmd_invoice_status(void) {
@@ -276,73 +430,258 @@ static void cmd_invoice_status(void) {
             printf("  [!] Invalid invoice ID.\n");
     } while (!validate_invoice_id(invoice_id));
 
-    if (!invoice_exists(&bc, &pool, invoice_id)) {
+    //one row of the state table gives the balance and status
+    bgminer_lock(&miner);
+    StrId        invoice = str_find(invoice_id);
+    InvoiceState inv;
+    if (!invoice_state(&bc, &pool, invoice, &inv)) {
         printf("  [!] Invoice %s not found.\n", invoice_id);
+        bgminer_unlock(&miner);
         return;
     }
 
     printf("\n  ===== Invoice: %s =====\n", invoice_id);
 
-    //Walk chain for all events on this invoice
-    for (int i = 0; i < bc.length; i++) {
-        for (int j = 0; j < bc.blocks[i].tx_count; j++) {
-            Transaction *t = &bc.blocks[i].transactions[j];
-            if (strcmp(t->invoice_id, invoice_id) != 0) continue;
-            char tbuf[32];
-            struct tm *tm = localtime(&t->event_time);
-            strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", tm);
-            printf("  [Block %u] %-16s | Amount: %8.2f | Balance: %8.2f | %s | %s\n",
-                   bc.blocks[i].block_id,
-                   t->type == TX_INVOICE_CREATE  ? "INVOICE_CREATE"  :
-                   t->type == TX_PAYMENT_MADE    ? "PAYMENT_MADE"    :
-                   t->type == TX_PAYMENT_CONFIRM ? "PAYMENT_CONFIRM" :
-                                                   "INVOICE_SETTLE",
-                   t->amount, t->balance, tbuf,
-                   t->confirmed ? "CONFIRMED" : "PENDING");
-        }
-    }
-    /* Pool */
-    for (int i = 0; i < pool.count; i++) {
-        Transaction *t = &pool.txs[i];
-        if (strcmp(t->invoice_id, invoice_id) != 0) continue;
+    //Walk all events on this invoice, mined first
+    EventCursor        cur;
+    const Transaction *t;
+    int                height;
+    invoice_events_begin(&cur, &bc, &pool, invoice);
+    while ((t = invoice_events_next(&cur, &height)) != NULL) {
+        const char *type =
+            t->type == TX_INVOICE_CREATE  ? "INVOICE_CREATE"  :
+            t->type == TX_PAYMENT_MADE    ? "PAYMENT_MADE"    :
+            t->type == TX_PAYMENT_CONFIRM ? "PAYMENT_CONFIRM" :
+                                            "INVOICE_SETTLE";
         char tbuf[32];
+        char amt[MONEY_STR_LEN], bal[MONEY_STR_LEN];
         struct tm *tm = localtime(&t->event_time);
         strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", tm);
-        printf("  [PENDING]   %-16s | Amount: %8.2f | Balance: %8.2f | %s | UNCONFIRMED\n",
-               t->type == TX_INVOICE_CREATE  ? "INVOICE_CREATE"  :
-               t->type == TX_PAYMENT_MADE    ? "PAYMENT_MADE"    :
-               t->type == TX_PAYMENT_CONFIRM ? "PAYMENT_CONFIRM" :
-                                               "INVOICE_SETTLE",
-               t->amount, t->balance, tbuf);
+        format_amount(t->amount, amt);
+        format_amount(t->balance, bal);
+        if (height == INDEX_POOL)
+            printf("  [PENDING]   %-16s | Amount: %8s | Balance: %8s | %s | UNCONFIRMED\n",
+                   type, amt, bal, tbuf);
+        else
+            printf("  [Block %u] %-16s | Amount: %8s | Balance: %8s | %s | %s\n",
+                   blockchain_block(&bc, height)->block_id, type,
+                   amt, bal, tbuf,
+                   payment_is_confirmed(&bc, &pool, t) ? "CONFIRMED"
+                                                       : "PENDING");
     }
 
-    double bal = get_balance(&bc, &pool, invoice_id);
-    printf("\n  Outstanding Balance : %.2f RWF\n", bal);
+    char amt[MONEY_STR_LEN];
+    printf("\n  Outstanding Balance : %s RWF\n",
+           format_amount(inv.balance, amt));
     printf("  Status              : %s\n",
-           invoice_settled(&bc, invoice_id) ? "SETTLED" :
-           (bal < 0.005 ? "CLEARED (mine to settle)" : "OUTSTANDING"));
+           inv.settled ? "SETTLED" :
+           (inv.balance == 0 ? "CLEARED (mine to settle)" : "OUTSTANDING"));
+    bgminer_unlock(&miner);
 }
 
-static void cmd_mine(void) {
-    printf("\n--- Mine Block ---\n");
-    printf("  Pending transactions: %d\n", pool.count);
-    if (pool.count == 0) {
-        printf("  Nothing to mine.\n");
+static void cmd_student_ledger(void) {
+    char student_id[MAX_STUDENT_ID];
+    printf("\n--- Student Ledger ---\n");
+
+    do {
+        read_line("  Student ID: ", student_id, sizeof(student_id));
+        if (!validate_student_id(student_id))
+            printf("  [!] Invalid student ID.\n");
+    } while (!validate_student_id(student_id));
+
+    int64_t total;
+    char    amt[MONEY_STR_LEN], bal[MONEY_STR_LEN];
+    bgminer_lock(&miner);
+    int     n = student_ledger(&bc, &pool, student_id, NULL, 0, &total);
+    InvoiceSummary *rows = n ? malloc((size_t)n * sizeof(*rows)) : NULL;
+    if (rows) student_ledger(&bc, &pool, student_id, rows, n, &total);
+    bgminer_unlock(&miner);
+    if (n == 0) {
+        printf("  [!] No invoices found for student %s.\n", student_id);
         return;
     }
+    if (!rows) {
+        fprintf(stderr, "Error: out of memory.\n");
+        return;
+    }
+
+    printf("\n  ===== Student: %s =====\n", student_id);
+    for (int i = 0; i < n; i++)
+        printf("  %-31s | Amount: %10s | Balance: %10s | %s\n",
+               rows[i].invoice_id, format_amount(rows[i].amount, amt),
+               format_amount(rows[i].balance, bal),
+               rows[i].settled ? "SETTLED" :
+               (rows[i].balance == 0 ? "CLEARED" : "OUTSTANDING"));
+    printf("\n  Invoices            : %d\n", n);
+    printf("  Total Outstanding   : %s RWF\n", format_amount(total, amt));
+    free(rows);
+}
+
+//receipt for the latest mined payment on an invoice: the payment, the
+//block header and the merkle path between them
+static void cmd_payment_proof(void) {
+    char invoice_id[MAX_INVOICE_ID];
+    printf("\n--- Payment Proof ---\n");
+
+    do {
+        read_line("  Invoice ID: ", invoice_id, sizeof(invoice_id));
+        if (!validate_invoice_id(invoice_id))
+            printf("  [!] Invalid invoice ID.\n");
+    } while (!validate_invoice_id(invoice_id));
 
-    Block b;
-    if (!pool_flush_to_block(&pool, &b, &bc)) return;
+    bgminer_lock(&miner);
+    EventCursor        cur;
+    const Transaction *t, *pay = NULL;
+    int                height, pay_height = 0;
+    invoice_events_begin(&cur, &bc, NULL, str_find(invoice_id));
+    while ((t = invoice_events_next(&cur, &height)) != NULL)
+        if (t->type == TX_PAYMENT_MADE) {
+            pay        = t;
+            pay_height = height;
+        }
+    if (!pay) {
+        printf("  [!] No mined payment found for invoice %s.\n", invoice_id);
+        bgminer_unlock(&miner);
+        return;
+    }
 
-    if (!mine_block(&b, bc.difficulty)) {
-        printf("  [!] Mining failed.\n");
+    const Block *blk  = blockchain_block(&bc, pay_height);
+    int          slot = (int)(pay - blk->transactions);
+    MerkleProof  proof;
+    uint8_t      leaf[32];
+    char         hex[HASH_HEX_LEN];
+    char         amt[MONEY_STR_LEN], bal[MONEY_STR_LEN];
+    if (!block_prove_tx(blk, slot, &proof)) {
+        printf("  [!] Could not build a proof.\n");
+        bgminer_unlock(&miner);
         return;
     }
 
-    if (blockchain_add_mined_block(&bc, &b)) {
-        printf("  [OK] Block %u added to chain.\n", b.block_id);
-        save_all();
+    merkle_leaf(pay, leaf);
+    sha256_digest_hex(leaf, hex);
+    printf("\n  Payment     : %s RWF on %s (ref: %s), balance after %s\n",
+           format_amount(pay->amount, amt), str_get(pay->invoice),
+           str_get(pay->reference), format_amount(pay->balance, bal));
+    printf("  Block       : %u\n", blk->block_id);
+    printf("  Block hash  : %s\n", blk->hash);
+    printf("  Merkle root : %s\n", blk->merkle_root);
+    printf("  Leaf        : %s (tx %u of %u)\n", hex, proof.index + 1,
+           proof.leaf_count);
+    for (uint32_t i = 0; i < proof.depth; i++) {
+        sha256_digest_hex(proof.siblings[i], hex);
+        printf("  Sibling %-3u : %s\n", i + 1, hex);
     }
+    printf("\n  Proof check : %s\n",
+           block_verify_tx(blk, pay, &proof) ? "VALID" : "INVALID");
+    bgminer_unlock(&miner);
+}
+
+static const char *seal_names[SEAL_REASONS] = { "mine", "size", "deadline" };
+
+//queue depth and time from queued to mined, for tuning the policy
+static void print_seal_stats(const BgMinerStatus *st) {
+    const SealStats *s = &st->seal;
+    int sealed = s->sealed[SEAL_MANUAL] + s->sealed[SEAL_SIZE] +
+                 s->sealed[SEAL_DEADLINE];
+
+    printf("  Sealing policy      : ");
+    if (st->policy.size > 0) printf("at %d pending", st->policy.size);
+    if (st->policy.size > 0 && st->policy.max_wait > 0) printf(" or ");
+    if (st->policy.max_wait > 0) printf("after %d s", st->policy.max_wait);
+    printf("%s\n", st->policy.size > 0 || st->policy.max_wait > 0
+                   ? "" : "only on 'mine'");
+    printf("  Blocks sealed       : %d (mine %d, size %d, deadline %d)\n",
+           sealed, s->sealed[SEAL_MANUAL], s->sealed[SEAL_SIZE],
+           s->sealed[SEAL_DEADLINE]);
+    printf("  Queue depth         : %d now, %d peak, %.1f average when "
+           "sealed\n", pool.count, s->peak_depth,
+           sealed ? (double)s->depth_at_seal / sealed : 0.0);
+    if (s->included == 0) return;
+    printf("  Time to inclusion   : %llu tx, mean %.1f s, max %.0f s\n",
+           (unsigned long long)s->included,
+           s->wait_total / (double)s->included, s->wait_max);
+    for (int k = 0; k < INCLUSION_BUCKETS; k++) {
+        char label[32];
+        if (!s->wait_hist[k]) continue;
+        if (k == INCLUSION_BUCKETS - 1)
+            snprintf(label, sizeof(label), "%d s and over", 1 << (k - 1));
+        else
+            snprintf(label, sizeof(label), "%d to %d s",
+                     k ? 1 << (k - 1) : 0, 1 << k);
+        printf("    %-16s  : %llu\n", label,
+               (unsigned long long)s->wait_hist[k]);
+    }
+}
+
+//what the background miner is doing; the expected work for b bits is
+//2^b hashes, so the percentage can pass 100 on an unlucky block
+static void cmd_mine_status(void) {
+    BgMinerStatus st;
+    bgminer_status(&miner, &st);
+
+    printf("\n--- Mining Status ---\n");
+    printf("  Pending transactions: %d\n", pool.count);
+    if (st.inflight) {
+        double expected = (double)(1ULL << (st.bits - 1)) * 2.0;
+        printf("  Mining block %u: %d transaction(s), %d bits, sealed by "
+               "%s\n", st.block_id, st.inflight, st.bits,
+               seal_names[st.reason]);
+        printf("  %.1f s, %llu hashes (%.0f H/s), %.0f%% of expected "
+               "work\n", st.seconds, (unsigned long long)st.hashes,
+               st.seconds > 0 ? (double)st.hashes / st.seconds : 0.0,
+               100.0 * (double)st.hashes / expected);
+        if (pool.count > st.inflight)
+            printf("  %d transaction(s) wait for the next block.\n",
+                   pool.count - st.inflight);
+    } else if (st.stopped) {
+        printf("  Miner stopped after an error; restart to mine again.\n");
+    } else {
+        printf("  Miner is idle%s.\n",
+               st.failed ? "; the last block could not be added" : "");
+    }
+    if (st.mined)
+        printf("  Mined this session: %d block(s); last was block %u "
+               "(%d transaction(s), %.1f s, %llu hashes)\n", st.mined,
+               st.last_id, st.last_txs, st.last_seconds,
+               (unsigned long long)st.last_hashes);
+    print_seal_stats(&st);
+}
+
+//mining runs in the background until the pool is empty; transactions
+//queued meanwhile go into the blocks after the current one
+static void cmd_mine(void) {
+    printf("\n--- Mine Block ---\n");
+    if (bgminer_inflight(&miner)) {
+        cmd_mine_status();
+        return;
+    }
+    printf("  Pending transactions: %d\n", pool.count);
+    if (!bgminer_request(&miner)) {
+        BgMinerStatus st;
+        bgminer_status(&miner, &st);
+        printf(st.stopped ? "  Mining stopped after an error; restart to "
+                            "try again.\n"
+                          : "  Nothing to mine.\n");
+        return;
+    }
+    printf("  [*] Mining in the background; type 'mine status' to follow "
+           "it.\n");
+}
+
+//announce blocks the miner added since the menu was last shown
+static void report_mined(void) {
+    static int    reported = 0;
+    BgMinerStatus st;
+    bgminer_status(&miner, &st);
+    if (st.mined == reported) return;
+    if (st.mined - reported > 1)
+        printf("\n  [OK] %d blocks added to chain, the last is block %u "
+               "(%d transaction(s)).\n", st.mined - reported, st.last_id,
+               st.last_txs);
+    else
+        printf("\n  [OK] Block %u added to chain (%d transaction(s)).\n",
+               st.last_id, st.last_txs);
+    reported = st.mined;
 }
 
 static void cmd_chain_view(void) {
@@ -352,8 +691,36 @@ static void cmd_chain_view(void) {
                pool.count);
 }
 
-static void cmd_chain_verify(void) {
-    blockchain_verify(&bc);
+//only blocks added since the last successful verify are rehashed unless
+//full is set
+static void cmd_chain_verify(int full) {
+    VerifyCheckpoint cp;
+    checkpoint_load(&cp, CHECKPOINT);
+    int before = cp.height;
+    if (blockchain_verify(&bc, &cp, full) && cp.height != before)
+        checkpoint_save(&cp, CHECKPOINT);
+
+    //the invoice state table against one rebuilt from the chain and pool
+    if (!ledger_index.valid) return;
+    StrId first;
+    int   bad = index_check(&ledger_index, &bc, &pool, &first);
+    if (bad < 0)
+        printf("Invoice state table: not checked (out of memory)\n");
+    else if (bad == 0)
+        printf("Invoice state table: %d invoice(s) match a rebuild\n",
+               ledger_index.invoice_map.used);
+    else
+        printf("Invoice state table: %d invoice(s) differ from a rebuild, "
+               "first %s\n", bad, str_get(first));
+}
+
+//counters and latencies since the program started
+static void cmd_stats(void) {
+#if ALU_STATS
+    stats_print();
+#else
+    printf("  [!] Statistics were left out of this build (STATS=0).\n");
+#endif
 }
 
 static void print_menu(void) {
@@ -363,37 +730,157 @@ static void print_menu(void) {
     printf("  2. payment record  – Record a payment       \n");
     printf("  3. payment confirm – Confirm a payment      \n");
     printf("  4. invoice status  – View invoice details   \n");
-    printf("  5. mine            – Mine pending block     \n");
+    printf("  5. mine            – Mine in the background \n");
     printf("  6. chain view      – Display blockchain     \n");
     printf("  7. chain verify    – Verify integrity       \n");
+    printf("  8. student ledger  – Student's invoices     \n");
+    printf("  9. payment proof   – Receipt for a payment  \n");
+    printf("     mine status     – Follow the miner       \n");
+    printf("     stats           – Counters and timings   \n");
     printf("  0. exit                                     \n");
     printf("  Pending txs: %d  |  Chain length: %d blocks\n",
            pool.count, bc.length);
+    BgMinerStatus st;
+    bgminer_status(&miner, &st);
+    if (st.inflight)
+        printf("  Mining block %u in the background ('mine status')\n",
+               st.block_id);
+}
+
+//non-interactive bulk load; exit status is 0 only if every record went in
+static int run_ingest(const char *path, int snap_every) {
+    int   from_stdin = strcmp(path, "-") == 0;
+    FILE *f          = from_stdin ? stdin : fopen(path, "r");
+    if (!f) {
+        perror(path);
+        close_all();
+        return 1;
+    }
+
+    IngestStats st;
+    int ok = ingest_stream(f, from_stdin ? "stdin" : path, &bc, &pool,
+                           &chain_log, &pool_log, &st);
+    if (!from_stdin) fclose(f);
+
+    int accepted = st.invoices + st.payments;
+    printf("Ingested %d record(s): %d invoice(s), %d payment(s), "
+           "%d rejected\n", accepted, st.invoices, st.payments, st.rejected);
+    printf("Mined %d block(s) in %.2f s (%.0f records/s), chain length %d\n",
+           st.blocks, st.seconds,
+           st.seconds > 0 ? accepted / st.seconds : 0.0, bc.length);
+    if (!ok) fprintf(stderr, "Error: ingest stopped early; records before "
+                             "the failure were kept.\n");
+    //no writer thread here, so the snapshot is taken on the way out
+    if (snap_every > 0 && bc.length - snap_height >= snap_every)
+        snapshot_save(&bc, STATE_SNAP);
+    close_all();
+    return ok && st.rejected == 0 ? 0 : 1;
 }
 
 //Entry  point 
 int main(int argc, char *argv[]) {
-    //Optional difficulty argument: ./alu_fees <difficulty>
-    int difficulty = 2;
-    if (argc == 2) {
-        int d = atoi(argv[1]);
-        if (d >= 1 && d <= 6) difficulty = d;
+    //Usage: ./alu_fees [difficulty] [--bits N] [--block-time S]
+    //                  [--retarget-window N] [--threads N] [--deterministic]
+    //                  [--block-size N] [--sync-ms N] [--mmap]
+    //                  [--pool-size N] [--seal-size N] [--seal-wait S]
+    //                  [--snapshot-every N] [ingest FILE|-]
+    //difficulty counts hex zeros (1-6); --bits sets leading zero bits
+    int difficulty = 2 * 4;
+    int block_time = 0;
+    int window     = DEFAULT_RETARGET_SPAN;
+    int sync_ms    = DEFAULT_SYNC_MS;
+    int mapped     = 0;
+    int block_txs  = DEFAULT_BLOCK_TXS;
+    int pool_limit = DEFAULT_POOL_LIMIT;
+    int seal_size  = -1;
+    int seal_wait  = DEFAULT_SEAL_WAIT;
+    int snap_every = DEFAULT_SNAPSHOT_EVERY;
+    const char *ingest_path = NULL;
+    MinerConfig mcfg;
+    miner_config_default(&mcfg);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bits") == 0 && i + 1 < argc) {
+            int b = atoi(argv[++i]);
+            if (b >= MIN_TARGET_BITS && b <= MAX_TARGET_BITS) difficulty = b;
+        } else if (strcmp(argv[i], "--block-time") == 0 && i + 1 < argc) {
+            block_time = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--retarget-window") == 0 &&
+                   i + 1 < argc) {
+            window = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sync-ms") == 0 && i + 1 < argc) {
+            sync_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pool-size") == 0 && i + 1 < argc) {
+            //0 lifts the limit
+            int n = atoi(argv[++i]);
+            if (n >= 0) pool_limit = n;
+        } else if (strcmp(argv[i], "--seal-size") == 0 && i + 1 < argc) {
+            //0 leaves it to the deadline
+            int n = atoi(argv[++i]);
+            if (n >= 0) seal_size = n;
+        } else if (strcmp(argv[i], "--seal-wait") == 0 && i + 1 < argc) {
+            int s = atoi(argv[++i]);
+            if (s >= 0) seal_wait = s;
+        } else if (strcmp(argv[i], "--snapshot-every") == 0 &&
+                   i + 1 < argc) {
+            //0 turns snapshots off
+            int n = atoi(argv[++i]);
+            if (n >= 0) snap_every = n;
+        } else if (strcmp(argv[i], "--block-size") == 0 && i + 1 < argc) {
+            block_txs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            mapped = 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            mcfg.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--deterministic") == 0) {
+            mcfg.deterministic = 1;
+        } else if (strcmp(argv[i], "ingest") == 0 && i + 1 < argc) {
+            ingest_path = argv[++i];
+        } else {
+            int d = atoi(argv[i]);
+            if (d >= 1 && d <= 6) difficulty = d * 4;
+        }
     }
+    miner_set_config(&mcfg);
 
     //Ensure data directory exists
     system("mkdir -p data");
 
-    load_all(difficulty);
+    load_all(difficulty, block_time, window, block_txs, sync_ms, mapped,
+             pool_limit);
+    if (ingest_path) return run_ingest(ingest_path, snap_every);
 
     printf("\nWelcome to the ALU Blockchain Fees System\n");
-    printf("Chain loaded: %d block(s), difficulty=%d\n",
-           bc.length, bc.difficulty);
+    printf("Chain loaded: %d block(s) of up to %d transaction(s), "
+           "difficulty=%d bits (next block %d)\n", bc.length, bc.block_txs,
+           bc.difficulty, blockchain_next_bits(&bc));
+    //by default a block is sealed once it would be full
+    SealPolicy seal = { seal_size < 0 ? bc.block_txs : seal_size, seal_wait };
+    if (!bgminer_start(&miner, &bc, &pool, &chain_log, &pool_log, &seal)) {
+        close_all();
+        return 1;
+    }
+    if (snap_every > 0)
+        snapshotter_start(&snapshotter, &bc, &miner.lock, STATE_SNAP,
+                          snap_every, snap_height);
 
+    //the miner can add blocks while a command waits for input, but not
+    //while it reads or changes the chain and pool: the commands that
+    //prompt take the lock once their input is in, the rest run under it
     char choice[64];
     while (1) {
+        bgminer_lock(&miner);
+        report_mined();
         print_menu();
+        bgminer_unlock(&miner);
         read_line("\nEnter choice: ", choice, sizeof(choice));
 
+        if (strcmp(choice, "0") == 0 || strcmp(choice, "exit") == 0 ||
+            feof(stdin)) {
+            close_all();
+            printf("Goodbye.\n");
+            break;
+        }
+
         if (strcmp(choice, "1") == 0 || strcmp(choice, "invoice create") == 0)
             cmd_invoice_create();
         else if (strcmp(choice, "2") == 0 || strcmp(choice, "payment record") == 0)
@@ -402,18 +889,30 @@ int main(int argc, char *argv[]) {
             cmd_payment_confirm();
         else if (strcmp(choice, "4") == 0 || strcmp(choice, "invoice status") == 0)
             cmd_invoice_status();
-        else if (strcmp(choice, "5") == 0 || strcmp(choice, "mine") == 0)
-            cmd_mine();
-        else if (strcmp(choice, "6") == 0 || strcmp(choice, "chain view") == 0)
-            cmd_chain_view();
-        else if (strcmp(choice, "7") == 0 || strcmp(choice, "chain verify") == 0)
-            cmd_chain_verify();
-        else if (strcmp(choice, "0") == 0 || strcmp(choice, "exit") == 0) {
-            save_all();
-            printf("Goodbye.\n");
-            break;
-        } else {
-            printf("  [!] Unknown command. Enter a number 0-7.\n");
+        else if (strcmp(choice, "8") == 0 || strcmp(choice, "student ledger") == 0)
+            cmd_student_ledger();
+        else if (strcmp(choice, "9") == 0 || strcmp(choice, "payment proof") == 0)
+            cmd_payment_proof();
+        else {
+            bgminer_lock(&miner);
+            if (strcmp(choice, "5") == 0 || strcmp(choice, "mine") == 0)
+                cmd_mine();
+            else if (strcmp(choice, "5 status") == 0 ||
+                     strcmp(choice, "mine status") == 0)
+                cmd_mine_status();
+            else if (strcmp(choice, "6") == 0 || strcmp(choice, "chain view") == 0)
+                cmd_chain_view();
+            else if (strcmp(choice, "7") == 0 || strcmp(choice, "chain verify") == 0)
+                cmd_chain_verify(0);
+            else if (strcmp(choice, "7 --full") == 0 ||
+                     strcmp(choice, "chain verify --full") == 0)
+                cmd_chain_verify(1);
+            else if (strcmp(choice, "stats") == 0)
+                cmd_stats();
+            else
+                printf("  [!] Unknown command. Enter a number 0-9 or a "
+                       "command name.\n");
+            bgminer_unlock(&miner);
         }
     }
     return 0;
@@ -0,0 +1,240 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "bgminer.h"
+#include "miner.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+//whether a block should be sealed now, and why; when only the deadline
+//is left to wait for, *deadline is set and *timed to 1. lock held
+static int seal_reason(BgMiner *m, struct timespec *deadline, int *timed) {
+    *timed = 0;
+    if (m->pool->count == 0) {
+        m->active = 0;
+        return -1;
+    }
+    if (m->active) return SEAL_MANUAL;
+    if (m->policy.size > 0 && m->pool->count >= m->policy.size)
+        return SEAL_SIZE;
+    if (m->policy.max_wait > 0) {
+        time_t due = pool_tx(m->pool, 0)->event_time + m->policy.max_wait;
+        if (time(NULL) >= due) return SEAL_DEADLINE;
+        deadline->tv_sec  = due;
+        deadline->tv_nsec = 0;
+        *timed = 1;
+    }
+    return -1;
+}
+
+static void record_inclusion(SealStats *s, const Block *b, int reason,
+                             int depth) {
+    time_t now = time(NULL);
+    s->sealed[reason]++;
+    s->depth_at_seal += (uint64_t)depth;
+    for (int i = 0; i < b->tx_count; i++) {
+        double wait = difftime(now, b->transactions[i].event_time);
+        int    k    = 0;
+        if (wait < 0) wait = 0;
+        while (k < INCLUSION_BUCKETS - 1 && wait >= (double)(1 << k)) k++;
+        s->wait_hist[k]++;
+        s->wait_total += wait;
+        if (wait > s->wait_max) s->wait_max = wait;
+    }
+    s->included += (uint64_t)b->tx_count;
+}
+
+//add a found block and take its transactions off the pool, lock held.
+//the block goes to the chain log before the chain, so a failed write
+//leaves nothing in memory that the files do not have
+static int commit_block(BgMiner *m, Block *b) {
+    if (!blockchain_check_mined_block(m->bc, b)) {
+        fprintf(stderr, "Error: mined block %u was not added; its "
+                        "transactions stay pending.\n", b->block_id);
+        return 0;
+    }
+    if (!chainlog_append(m->chain_log, b)) {
+        //nothing more is mined until a restart, the next write would
+        //most likely fail the same way
+        fprintf(stderr, "Error: block %u could not be written to the "
+                        "chain log; background mining stopped.\n",
+                b->block_id);
+        m->stop = 1;
+        return 0;
+    }
+    if (!blockchain_push(m->bc, b)) {
+        //logged but not in memory: a restart reads it back
+        fprintf(stderr, "Error: out of memory adding block %u; background "
+                        "mining stopped, restart to load it.\n", b->block_id);
+        m->stop = 1;
+        return 0;
+    }
+    pool_discard(m->pool, b->tx_count);
+    poollog_take(m->pool_log, m->pool, b);
+    record_inclusion(&m->seal, b, m->reason, m->depth);
+    return 1;
+}
+
+static void *bgminer_main(void *arg) {
+    BgMiner *m = arg;
+
+    pthread_mutex_lock(&m->lock);
+    for (;;) {
+        struct timespec deadline;
+        int             timed, reason = -1;
+        while (!m->stop && (reason = seal_reason(m, &deadline, &timed)) < 0) {
+            pthread_cond_broadcast(&m->done);
+            if (timed)
+                pthread_cond_timedwait(&m->wake, &m->lock, &deadline);
+            else
+                pthread_cond_wait(&m->wake, &m->lock);
+        }
+        if (m->stop) break;
+
+        Block *b = block_new(m->bc->block_txs);
+        if (!b) {
+            fprintf(stderr, "Error: out of memory starting a block; "
+                            "background mining stopped.\n");
+            m->failed = 1;
+            m->active = 0;
+            m->stop   = 1;
+            pthread_cond_broadcast(&m->done);
+            break;
+        }
+        pool_fill_block(m->pool, b, m->bc);
+        m->inflight   = b->tx_count;
+        m->reason     = reason;
+        m->depth      = m->pool->count;
+        m->block_id   = b->block_id;
+        m->bits       = (int)b->target_bits;
+        m->started_at = now_seconds();
+        __atomic_store_n(&m->hashes, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&m->lock);
+
+        //the search itself runs unlocked on a private copy of the block
+        MinerConfig cfg = *miner_get_config();
+        cfg.quiet  = 1;
+        cfg.report = 0;
+        cfg.cancel = &m->cancel;
+        cfg.hashes = &m->hashes;
+        int found = mine_block_parallel(b, m->bits, &cfg, NULL);
+
+        pthread_mutex_lock(&m->lock);
+        m->inflight = 0;
+        if (found && commit_block(m, b)) {
+            m->mined++;
+            m->last_id      = b->block_id;
+            m->last_txs     = b->tx_count;
+            m->last_seconds = now_seconds() - m->started_at;
+            m->last_hashes  = __atomic_load_n(&m->hashes, __ATOMIC_RELAXED);
+        } else if (found) {
+            m->failed = 1;
+            m->active = 0;
+        }
+        free(b);
+        pthread_cond_broadcast(&m->done);
+    }
+    pthread_mutex_unlock(&m->lock);
+    return NULL;
+}
+
+int bgminer_start(BgMiner *m, Blockchain *bc, TxPool *p,
+                  ChainLog *chain_log, PoolLog *pool_log,
+                  const SealPolicy *policy) {
+    memset(m, 0, sizeof(*m));
+    m->bc        = bc;
+    m->pool      = p;
+    m->chain_log = chain_log;
+    m->pool_log  = pool_log;
+    m->policy    = *policy;
+    //a block cannot take more than the chain's block size
+    if (m->policy.size > bc->block_txs) m->policy.size = bc->block_txs;
+    m->seal.peak_depth = p->count;
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_cond_init(&m->wake, NULL);
+    pthread_cond_init(&m->done, NULL);
+    if (pthread_create(&m->thread, NULL, bgminer_main, m) != 0) {
+        fprintf(stderr, "Error: could not start the mining thread.\n");
+        return 0;
+    }
+    m->started = 1;
+    return 1;
+}
+
+int bgminer_stop(BgMiner *m) {
+    if (!m->started) return 0;
+    pthread_mutex_lock(&m->lock);
+    int cancelled = m->inflight;
+    int mined     = m->mined;
+    m->stop = 1;
+    __atomic_store_n(&m->cancel, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&m->wake);
+    pthread_mutex_unlock(&m->lock);
+    pthread_join(m->thread, NULL);
+    //it may have found the nonce before it saw the cancel
+    if (m->mined != mined) cancelled = 0;
+    m->started = 0;
+    pthread_cond_destroy(&m->done);
+    pthread_cond_destroy(&m->wake);
+    pthread_mutex_destroy(&m->lock);
+    return cancelled;
+}
+
+void bgminer_lock(BgMiner *m) {
+    pthread_mutex_lock(&m->lock);
+}
+
+void bgminer_unlock(BgMiner *m) {
+    pthread_mutex_unlock(&m->lock);
+}
+
+int bgminer_request(BgMiner *m) {
+    if (!m->started || m->stop || m->pool->count == 0) return 0;
+    m->active = 1;
+    m->failed = 0;
+    pthread_cond_signal(&m->wake);
+    return 1;
+}
+
+void bgminer_queued(BgMiner *m) {
+    if (m->pool->count > m->seal.peak_depth)
+        m->seal.peak_depth = m->pool->count;
+    if (m->started) pthread_cond_signal(&m->wake);
+}
+
+int bgminer_wait(BgMiner *m) {
+    int before = m->mined;
+    while (m->mined == before && m->active && !m->stop)
+        pthread_cond_wait(&m->done, &m->lock);
+    return m->mined != before;
+}
+
+int bgminer_inflight(const BgMiner *m) {
+    return m->inflight;
+}
+
+void bgminer_status(const BgMiner *m, BgMinerStatus *st) {
+    st->active       = m->active;
+    st->failed       = m->failed;
+    st->stopped      = m->stop;
+    st->inflight     = m->inflight;
+    st->reason       = m->reason;
+    st->block_id     = m->block_id;
+    st->bits         = m->bits;
+    st->seconds      = m->inflight ? now_seconds() - m->started_at : 0;
+    st->hashes       = __atomic_load_n(&m->hashes, __ATOMIC_RELAXED);
+    st->mined        = m->mined;
+    st->last_id      = m->last_id;
+    st->last_txs     = m->last_txs;
+    st->last_seconds = m->last_seconds;
+    st->last_hashes  = m->last_hashes;
+    st->policy       = m->policy;
+    st->seal         = m->seal;
+}
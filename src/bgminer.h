@@ -0,0 +1,121 @@
+#ifndef BGMINER_H
+#define BGMINER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "blockchain.h"
+#include "chainlog.h"
+
+//background miner: a worker thread that mines the pending pool into
+//blocks while the CLI keeps running. lock guards the chain, the pool,
+//their logs and the index; whoever reads or changes them holds it. the
+//worker only holds it to copy the next block's transactions out of the
+//pool and to add the finished block, so the proof of work runs without
+//it. the transactions being mined stay at the head of the pool until
+//their block is in the chain, and anything queued meanwhile goes into a
+//later block
+
+//when to seal a block without being asked: once size transactions are
+//pending or the oldest of them has waited max_wait seconds, whichever
+//comes first; 0 turns either off. 'mine' always seals at once. waits
+//are measured from each transaction's event_time
+#define DEFAULT_SEAL_WAIT 30
+
+typedef struct {
+    int size;
+    int max_wait;
+} SealPolicy;
+
+enum { SEAL_MANUAL, SEAL_SIZE, SEAL_DEADLINE, SEAL_REASONS };
+
+//time to inclusion is bucketed by powers of two: bucket 0 is under a
+//second, bucket k is 2^(k-1) up to 2^k seconds and the last is open
+#define INCLUSION_BUCKETS 12
+
+//sealing metrics since start, counted when a block goes in
+typedef struct {
+    int      sealed[SEAL_REASONS];  /* blocks, by what sealed them */
+    int      peak_depth;            /* most transactions pending at once */
+    uint64_t depth_at_seal;         /* pending when sealed, summed */
+    uint64_t included;              /* transactions mined */
+    double   wait_total;            /* their seconds from queued to mined */
+    double   wait_max;
+    uint64_t wait_hist[INCLUSION_BUCKETS];
+} SealStats;
+
+typedef struct {
+    Blockchain     *bc;
+    TxPool         *pool;
+    ChainLog       *chain_log;
+    PoolLog        *pool_log;
+    SealPolicy      policy;
+    SealStats       seal;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;        /* mining requested, or stop */
+    pthread_cond_t  done;        /* a block went in, or the miner idled */
+    pthread_t       thread;
+    int             started;
+    int             stop;        /* also set after a log or memory error */
+    int             cancel;      /* stops the search in progress */
+    int             active;      /* keep mining until the pool is empty */
+    int             failed;      /* the last block could not be added */
+    //the block being mined; inflight = 0 when idle
+    int             inflight;    /* pool transactions it holds */
+    uint32_t        block_id;
+    int             bits;
+    int             reason;      /* SEAL_* */
+    int             depth;       /* pool count when it was sealed */
+    double          started_at;
+    uint64_t        hashes;      /* tried on this block so far */
+    //blocks added since start, and the last one
+    int             mined;
+    uint32_t        last_id;
+    int             last_txs;
+    double          last_seconds;
+    uint64_t        last_hashes;
+} BgMiner;
+
+//snapshot of what the miner is doing, for progress reports
+typedef struct {
+    int      active;
+    int      failed;
+    int      stopped;     /* after a log or memory error */
+    int      inflight;
+    int      reason;
+    uint32_t block_id;
+    int      bits;
+    double   seconds;
+    uint64_t hashes;
+    int      mined;
+    uint32_t last_id;
+    int      last_txs;
+    double   last_seconds;
+    uint64_t last_hashes;
+    SealPolicy policy;
+    SealStats  seal;
+} BgMinerStatus;
+
+int  bgminer_start(BgMiner *m, Blockchain *bc, TxPool *p,
+                   ChainLog *chain_log, PoolLog *pool_log,
+                   const SealPolicy *policy);
+//cancels the block in progress (its transactions stay pending) and
+//joins the worker; call without the lock. returns how many transactions
+//the cancelled block held
+int  bgminer_stop(BgMiner *m);
+
+void bgminer_lock(BgMiner *m);
+void bgminer_unlock(BgMiner *m);
+
+//the rest are called with the lock held.
+//request: start mining if idle, returns 0 if there is nothing pending or
+//the miner has stopped
+int  bgminer_request(BgMiner *m);
+//queued: a transaction was added to the pool; lets the policy seal
+void bgminer_queued(BgMiner *m);
+//wait: give up the lock until the next block is added; returns 0 if
+//the miner went idle or failed first
+int  bgminer_wait(BgMiner *m);
+int  bgminer_inflight(const BgMiner *m);
+void bgminer_status(const BgMiner *m, BgMinerStatus *st);
+
+#endif
@@ -1,71 +1,287 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "blockchain.h"
+#include "index.h"
+#include "merkle.h"
 #include "sha256.h"
+#include "miner.h"
+#include "stats.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <pthread.h>
+
+//little-endian writers for the binary block layout
+static uint8_t *put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+    return p + 4;
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+    return p + 8;
+}
+
+//fixed-width string field, zero padded past the terminator
+static uint8_t *put_str(uint8_t *p, const char *s, size_t width) {
+    const char *end = memchr(s, '\0', width);
+    size_t n = end ? (size_t)(end - s) : width;
+    memcpy(p, s, n);
+    memset(p + n, 0, width - n);
+    return p + width;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) v |= (uint32_t)p[i] << (8 * i);
+    return v;
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+//interns a fixed-width string field; 0 if it fills the field unterminated
+static int get_str(const uint8_t *p, size_t width, StrId *out) {
+    char s[MAX_REF];
+    if (!memchr(p, '\0', width)) return 0;
+    memcpy(s, p, width);
+    *out = s[0] ? str_intern(s) : STR_NONE;
+    return 1;
+}
+
+static int hex_val(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 0;
+}
+
+static uint8_t *put_hash(uint8_t *p, const char *hex) {
+    for (int i = 0; i < 32; i++)
+        p[i] = (uint8_t)((hex_val(hex[i*2]) << 4) | hex_val(hex[i*2 + 1]));
+    return p + 32;
+}
+
+//a zeroed block with room for tx_cap transactions; free() it when done
+Block *block_new(int tx_cap) {
+    return calloc(1, BLOCK_BYTES(tx_cap > 0 ? tx_cap : 0));
+}
+
+//serialise one transaction into out (TX_SER_LEN bytes), returns length
+size_t tx_serialize(const Transaction *t, uint8_t *out) {
+    uint8_t *p = out;
+    p = put_u32(p, (uint32_t)t->type);
+    p = put_str(p, str_get(t->student), MAX_STUDENT_ID);
+    p = put_str(p, str_get(t->invoice), MAX_INVOICE_ID);
+    p = put_u64(p, (uint64_t)t->amount);
+    p = put_u64(p, (uint64_t)t->balance);
+    p = put_str(p, str_get(t->reference), MAX_REF);
+    p = put_u64(p, (uint64_t)(int64_t)t->event_time);
+    p = put_u32(p, (uint32_t)t->confirmed);
+    return (size_t)(p - out);
+}
+
+int tx_deserialize(const uint8_t *in, Transaction *t) {
+    const uint8_t *p = in;
+    uint32_t type, confirmed;
+    memset(t, 0, sizeof(*t));
+    type = get_u32(p);                                  p += 4;
+    if (!get_str(p, MAX_STUDENT_ID, &t->student)) return 0;
+    p += MAX_STUDENT_ID;
+    if (!get_str(p, MAX_INVOICE_ID, &t->invoice)) return 0;
+    p += MAX_INVOICE_ID;
+    t->amount  = (int64_t)get_u64(p);                   p += 8;
+    t->balance = (int64_t)get_u64(p);                   p += 8;
+    if (!get_str(p, MAX_REF, &t->reference)) return 0;
+    p += MAX_REF;
+    t->event_time = (time_t)(int64_t)get_u64(p);        p += 8;
+    confirmed = get_u32(p);
+    if (type > TX_INVOICE_SETTLE || confirmed > 1) return 0;
+    t->type      = (uint16_t)type;
+    t->confirmed = (uint16_t)confirmed;
+    return 1;
+}
+
+static int64_t minor_units(double d) {
+    d *= MONEY_SCALE;
+    return (int64_t)(d < 0 ? d - 0.5 : d + 0.5);
+}
+
+//copies a fixed-width field that may fill its width unterminated
+static StrId intern_field(const char *s, size_t width) {
+    char buf[MAX_REF + 1];
+    memcpy(buf, s, width);
+    buf[width] = '\0';
+    return buf[0] ? str_intern(buf) : STR_NONE;
+}
+
+void tx_from_wide(Transaction *t, const WideTx *w) {
+    t->type       = (uint16_t)w->type;
+    t->confirmed  = w->confirmed != 0;
+    t->student    = intern_field(w->student_id, MAX_STUDENT_ID);
+    t->invoice    = intern_field(w->invoice_id, MAX_INVOICE_ID);
+    t->reference  = intern_field(w->reference, MAX_REF);
+    t->amount     = minor_units(w->amount);
+    t->balance    = minor_units(w->balance);
+    t->event_time = (time_t)w->event_time;
+}
+
+//serialise the block header into out (BLOCK_HEADER_LEN bytes), returns
+//length
+size_t block_serialize(const Block *b, uint8_t *out) {
+    uint8_t *p = out;
+    int count = b->tx_count < 0 ? 0 : b->tx_count;
+
+    p = put_u32(p, b->block_id);
+    p = put_u64(p, (uint64_t)(int64_t)b->timestamp);
+    p = put_hash(p, b->prev_hash);
+    p = put_hash(p, b->merkle_root);
+    p = put_u32(p, b->target_bits);
+    p = put_u32(p, (uint32_t)count);
+    p = put_u64(p, b->nonce);
+    return (size_t)(p - out);
+}
+
+static int block_tx_count(const Block *b) {
+    return b->tx_count < 0 ? 0 : b->tx_count;
+}
+
+void block_set_merkle_root(Block *b) {
+    uint8_t root[32];
+    merkle_root(b->transactions, block_tx_count(b), root);
+    sha256_digest_hex(root, b->merkle_root);
+}
+
+int block_merkle_ok(const Block *b) {
+    uint8_t root[32];
+    char    hex[HASH_HEX_LEN];
+    merkle_root(b->transactions, block_tx_count(b), root);
+    sha256_digest_hex(root, hex);
+    return strcmp(hex, b->merkle_root) == 0;
+}
 
 // hash comptation funtion
-void compute_block_hash(Block *b, char *out_hex) {
-    char buf[8192];
-    int  len = 0;
-
-    len += snprintf(buf + len, sizeof(buf) - len,
-                    "%u|%ld|%s|%llu",
-                    b->block_id,
-                    (long)b->timestamp,
-                    b->prev_hash,
-                    (unsigned long long)b->nonce);
-
-    for (int i = 0; i < b->tx_count; i++) {
-        Transaction *t = &b->transactions[i];
-        len += snprintf(buf + len, sizeof(buf) - len,
-                        "|TX%d:%s:%s:%.2f:%.2f:%s:%d",
-                        t->type,
-                        t->student_id,
-                        t->invoice_id,
-                        t->amount,
-                        t->balance,
-                        t->reference,
-                        t->confirmed);
-    }
+void compute_block_hash(const Block *b, char *out_hex) {
+    STAT_TIME_START(start);
+    uint8_t buf[BLOCK_HEADER_LEN];
+    size_t  len = block_serialize(b, buf);
+    sha256_hex(buf, len, out_hex);
+    STAT_TIME_STOP(TIMER_BLOCK_HASH, start);
+}
 
-    sha256_hex((const uint8_t *)buf, (size_t)len, out_hex);
+//proof of work: the digest must start with `bits` zero bits
+int hash_meets_target(const uint8_t *digest, int bits) {
+    int i = 0;
+    for (; bits >= 8; bits -= 8, i++)
+        if (digest[i] != 0) return 0;
+    return bits == 0 || (digest[i] >> (8 - bits)) == 0;
 }
 
-// mining proof of wrk
-int mine_block(Block *b, int difficulty) {
-    char hash[HASH_HEX_LEN];
-    char prefix[64];
+//same check on a stored hex hash
+int hex_meets_target(const char *hex, int bits) {
+    int i = 0;
+    for (; bits >= 4; bits -= 4, i++)
+        if (hex[i] != '0') return 0;
+    return bits == 0 || (hex_val(hex[i]) >> (4 - bits)) == 0;
+}
 
-    if (difficulty < 1 || difficulty > 8) difficulty = 2;
-    memset(prefix, '0', difficulty);
-    prefix[difficulty] = '\0';
+//bloack chain lifecycle
 
-    b->nonce = 0;
-    printf("Mining block %u (difficulty=%d) ", b->block_id, difficulty);
-    fflush(stdout);
+static int clamp_bits(int bits) {
+    if (bits < MIN_TARGET_BITS) return MIN_TARGET_BITS;
+    if (bits > MAX_TARGET_BITS) return MAX_TARGET_BITS;
+    return bits;
+}
 
-    while (1) {
-        compute_block_hash(b, hash);
-        if (strncmp(hash, prefix, difficulty) == 0) {
-            memcpy(b->hash, hash, HASH_HEX_LEN);
-            printf(" done!\n");
-            printf("  Hash: %s  Nonce: %llu\n",
-                   b->hash, (unsigned long long)b->nonce);
-            return 1;
+//storage
+
+const Block *blockchain_block(const Blockchain *bc, int index) {
+    return bc->blocks[index];
+}
+
+const Block *blockchain_tip(const Blockchain *bc) {
+    return bc->length > 0 ? blockchain_block(bc, bc->length - 1) : NULL;
+}
+
+//room for one more entry in the height table
+static int chain_reserve(Blockchain *bc) {
+    if (bc->length < bc->block_cap) return 1;
+    int           cap = bc->block_cap ? bc->block_cap * 2 : 1024;
+    const Block **tbl = realloc(bc->blocks, (size_t)cap * sizeof(*tbl));
+    if (!tbl) return 0;
+    bc->blocks    = tbl;
+    bc->block_cap = cap;
+    return 1;
+}
+
+//8-byte aligned space for `bytes` in the arena, starting a new chunk when
+//the newest one is full; chunks are never moved or resized
+static void *arena_alloc(Blockchain *bc, size_t bytes) {
+    bytes = (bytes + 7) & ~(size_t)7;
+    if (bc->chunk_count == 0 || bc->chunk_used + bytes > bc->chunk_size) {
+        if (bc->chunk_count == bc->chunk_cap) {
+            int       cap = bc->chunk_cap ? bc->chunk_cap * 2 : 16;
+            uint8_t **tbl = realloc(bc->chunks, (size_t)cap * sizeof(*tbl));
+            if (!tbl) return NULL;
+            bc->chunks    = tbl;
+            bc->chunk_cap = cap;
         }
-        b->nonce++;
-        if (b->nonce % 100000 == 0) { printf("."); fflush(stdout); }
+        size_t   size  = bytes > BLOCK_ARENA_CHUNK ? bytes : BLOCK_ARENA_CHUNK;
+        uint8_t *chunk = malloc(size);
+        if (!chunk) return NULL;
+        bc->chunks[bc->chunk_count++] = chunk;
+        bc->chunk_size = size;
+        bc->chunk_used = 0;
     }
+    void *p = bc->chunks[bc->chunk_count - 1] + bc->chunk_used;
+    bc->chunk_used += bytes;
+    return p;
 }
 
-//bloack chain lifecycle
+//append a block that lives elsewhere and outlives the chain; it has
+//already been validated (e.g. read back from storage)
+int blockchain_push_ref(Blockchain *bc, const Block *b) {
+    if (!chain_reserve(bc)) return 0;
+    bc->blocks[bc->length++] = b;
+    if (bc->index) index_add_block(bc->index, bc->length - 1, b);
+    return 1;
+}
+
+//append a copy of a block that has already been validated without
+//re-checking it; only its tx_count transactions are copied
+int blockchain_push(Blockchain *bc, const Block *b) {
+    int    n    = b->tx_count < 0 ? 0 : b->tx_count;
+    Block *copy = chain_reserve(bc) ? arena_alloc(bc, BLOCK_BYTES(n)) : NULL;
+    if (!copy) return 0;
+    memcpy(copy, b, BLOCK_BYTES(n));
+    return blockchain_push_ref(bc, copy);
+}
+
+void blockchain_free(Blockchain *bc) {
+    for (int i = 0; i < bc->chunk_count; i++) free(bc->chunks[i]);
+    free(bc->chunks);
+    free(bc->blocks);
+    bc->blocks      = NULL;
+    bc->length      = 0;
+    bc->block_cap   = 0;
+    bc->chunks      = NULL;
+    bc->chunk_count = 0;
+    bc->chunk_cap   = 0;
+    bc->chunk_used  = 0;
+    bc->chunk_size  = 0;
+}
 
 void blockchain_init(Blockchain *bc, int difficulty) {
     memset(bc, 0, sizeof(*bc));
     bc->length     = 0;
-    bc->difficulty = (difficulty >= 1 && difficulty <= 8) ? difficulty : 2;
+    bc->difficulty = (difficulty >= MIN_TARGET_BITS &&
+                      difficulty <= MAX_TARGET_BITS) ? difficulty : 8;
+    bc->retarget_window = DEFAULT_RETARGET_SPAN;
+    bc->block_txs       = DEFAULT_BLOCK_TXS;
 
     //genesis block created here
     Block genesis;
@@ -75,34 +291,94 @@ void blockchain_init(Blockchain *bc, int difficulty) {
     memset(genesis.prev_hash, '0', 64);
     genesis.prev_hash[64] = '\0';
     genesis.tx_count  = 0;
+    block_set_merkle_root(&genesis);
 
     mine_block(&genesis, bc->difficulty);
-    bc->blocks[0] = genesis;
-    bc->length    = 1;
+    if (!blockchain_push(bc, &genesis))
+        fprintf(stderr, "Error: out of memory for genesis block.\n");
 }
 
-int blockchain_add_mined_block(Blockchain *bc, Block *b) {
-    if (bc->length >= MAX_BLOCKS) {
-        fprintf(stderr, "Error: blockchain full.\n");
-        return 0;
+//aim for a mean of block_time seconds between blocks, re-evaluated every
+//window blocks; block_time 0 keeps the difficulty fixed
+void blockchain_set_retarget(Blockchain *bc, int block_time, int window) {
+    bc->target_block_time = block_time > 0 ? block_time : 0;
+    bc->retarget_window   = window > 1 ? window : DEFAULT_RETARGET_SPAN;
+}
+
+//target bits the block at `height` must carry; heights are checked in
+//order, so the earlier blocks' bits are already trusted
+int blockchain_bits_at(const Blockchain *bc, int height) {
+    if (height <= 0) return bc->difficulty;
+
+    int prev = (int)blockchain_block(bc, height - 1)->target_bits;
+    int win  = bc->retarget_window;
+    if (bc->target_block_time <= 0 || win <= 1 ||
+        height % win != 0 || height < win)
+        return prev;
+
+    //compare the last window's span against the configured mean
+    double actual   = (double)(blockchain_block(bc, height - 1)->timestamp -
+                               blockchain_block(bc, height - win)->timestamp);
+    double expected = (double)bc->target_block_time * (win - 1);
+    if (actual < 1) actual = 1;
+
+    //each bit doubles the expected work, so step by the rounded log2
+    double ratio = expected / actual;
+    int    step  = 0;
+    while (ratio >= 1.41421356 && step <  MAX_RETARGET_STEP) {
+        ratio /= 2;
+        step++;
+    }
+    while (ratio <= 0.70710678 && step > -MAX_RETARGET_STEP) {
+        ratio *= 2;
+        step--;
     }
+    return clamp_bits(prev + step);
+}
+
+//transactions a block may hold; only meaningful before the chain is
+//first written out, after that it is part of the chain
+void blockchain_set_block_txs(Blockchain *bc, int txs) {
+    bc->block_txs = txs < 1 ? 1 : txs > MAX_BLOCK_TXS ? MAX_BLOCK_TXS : txs;
+}
+
+int blockchain_next_bits(const Blockchain *bc) {
+    return blockchain_bits_at(bc, bc->length);
+}
 
+int blockchain_check_mined_block(const Blockchain *bc, const Block *b) {
     //validate previous hash for linkage
-    Block *prev = &bc->blocks[bc->length - 1];
+    const Block *prev = blockchain_tip(bc);
     if (strcmp(b->prev_hash, prev->hash) != 0) {
         fprintf(stderr, "Error: prev_hash mismatch.\n");
         return 0;
     }
 
     //veriy proof of work
-    char prefix[64];
-    memset(prefix, '0', bc->difficulty);
-    prefix[bc->difficulty] = '\0';
-    if (strncmp(b->hash, prefix, bc->difficulty) != 0) {
+    int bits = blockchain_next_bits(bc);
+    if ((int)b->target_bits != bits) {
+        fprintf(stderr, "Error: block target is %u bits, expected %d.\n",
+                b->target_bits, bits);
+        return 0;
+    }
+    if (!hex_meets_target(b->hash, bits)) {
         fprintf(stderr, "Error: block does not satisfy PoW.\n");
         return 0;
     }
 
+    if (b->tx_count < 0 || b->tx_count > bc->block_txs) {
+        fprintf(stderr, "Error: block holds %d transactions, the chain "
+                        "allows %d.\n", b->tx_count, bc->block_txs);
+        return 0;
+    }
+
+    //the header has to commit to these transactions
+    if (!block_merkle_ok(b)) {
+        fprintf(stderr, "Error: block merkle root does not match its "
+                        "transactions.\n");
+        return 0;
+    }
+
     //veryfying hash corrects
     char expected[HASH_HEX_LEN];
     compute_block_hash(b, expected);
@@ -110,44 +386,199 @@ int blockchain_add_mined_block(Blockchain *bc, Block *b) {
         fprintf(stderr, "Error: block hash is incorrect.\n");
         return 0;
     }
+    return 1;
+}
 
-    bc->blocks[bc->length] = *b;
-    bc->length++;
+int blockchain_add_mined_block(Blockchain *bc, Block *b) {
+    if (!blockchain_check_mined_block(bc, b)) return 0;
+    if (!blockchain_push(bc, b)) {
+        fprintf(stderr, "Error: out of memory growing the chain.\n");
+        return 0;
+    }
     return 1;
 }
 
-int blockchain_verify(const Blockchain *bc) {
-    char prefix[64];
-    memset(prefix, '0', bc->difficulty);
-    prefix[bc->difficulty] = '\0';
+//blocks are verified in chunks handed out to worker threads; each block
+//needs only itself and its predecessor's stored hash
+#define VERIFY_CHUNK 1024
+
+enum { VERIFY_HASH = 1, VERIFY_POW = 2, VERIFY_LINK = 4, VERIFY_MERKLE = 8 };
+
+typedef struct {
+    const Blockchain *bc;
+    int               next;         /* next chunk start, claimed atomically */
+    pthread_mutex_t   lock;
+    int               first_bad;    /* lowest failing height, -1 = none */
+    int               first_flags;  /* VERIFY_* failures of that block */
+    int               failures;
+} VerifyJob;
+
+//checks blocks [from, to): stored hash against a recomputed one, proof
+//of work, and the link to the previous block's stored hash
+static void verify_span(VerifyJob *job, int from, int to) {
+    const Blockchain *bc = job->bc;
+    //blocks are rehashed SHA256_LANES at a time with the multi-buffer kernel
+    uint8_t        bufs[SHA256_LANES][BLOCK_HEADER_LEN];
+    const uint8_t *msgs[SHA256_LANES];
+    size_t         lens[SHA256_LANES];
+    uint8_t        digests[SHA256_LANES][32];
+    int            first_bad = -1, first_flags = 0, failures = 0;
+
+    for (int base = from; base < to; base += SHA256_LANES) {
+        int n = to - base;
+        if (n > SHA256_LANES) n = SHA256_LANES;
+        for (int k = 0; k < n; k++) {
+            lens[k] = block_serialize(blockchain_block(bc, base + k),
+                                      bufs[k]);
+            msgs[k] = bufs[k];
+        }
+        sha256_x8(msgs, lens, n, digests);
+
+        for (int k = 0; k < n; k++) {
+            int i = base + k;
+            const Block *b = blockchain_block(bc, i);
+            char computed[HASH_HEX_LEN];
+            sha256_digest_hex(digests[k], computed);
+
+            int flags = 0;
+            if (strcmp(b->hash, computed) != 0) flags |= VERIFY_HASH;
+            if ((int)b->target_bits != blockchain_bits_at(bc, i) ||
+                !hex_meets_target(b->hash, (int)b->target_bits))
+                flags |= VERIFY_POW;
+            if (i > 0 &&
+                strcmp(b->prev_hash, blockchain_block(bc, i-1)->hash) != 0)
+                flags |= VERIFY_LINK;
+            if (b->tx_count < 0 || b->tx_count > bc->block_txs ||
+                !block_merkle_ok(b))
+                flags |= VERIFY_MERKLE;
+
+            if (flags) {
+                if (first_bad < 0) {
+                    first_bad   = i;
+                    first_flags = flags;
+                }
+                failures++;
+            }
+        }
+    }
 
+    if (!failures) return;
+    pthread_mutex_lock(&job->lock);
+    job->failures += failures;
+    if (job->first_bad < 0 || first_bad < job->first_bad) {
+        job->first_bad   = first_bad;
+        job->first_flags = first_flags;
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void *verify_worker(void *arg) {
+    VerifyJob *job = arg;
+    int        end = job->bc->length;
+    for (;;) {
+        int from = __atomic_fetch_add(&job->next, VERIFY_CHUNK,
+                                      __ATOMIC_RELAXED);
+        if (from >= end) break;
+        verify_span(job, from, from + VERIFY_CHUNK < end ? from + VERIFY_CHUNK
+                                                         : end);
+    }
+    return NULL;
+}
+
+//verifies [from, bc->length) on up to miner_thread_count() threads and
+//prints one summary; the first failure reported is always the lowest
+static int verify_range(const Blockchain *bc, int from) {
+    VerifyJob job;
+    pthread_t tids[MINER_MAX_THREADS];
+    int       count   = bc->length - from;
+    int       threads = miner_thread_count(miner_get_config());
+    if (threads > (count + VERIFY_CHUNK - 1) / VERIFY_CHUNK)
+        threads = (count + VERIFY_CHUNK - 1) / VERIFY_CHUNK;
+    if (threads < 1) threads = 1;
+
+    memset(&job, 0, sizeof(job));
+    job.bc        = bc;
+    job.next      = from;
+    job.first_bad = -1;
+    pthread_mutex_init(&job.lock, NULL);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    //the calling thread works too
+    int started = 1;
+    while (started < threads &&
+           pthread_create(&tids[started], NULL, verify_worker, &job) == 0)
+        started++;
+    verify_worker(&job);
+    for (int i = 1; i < started; i++) pthread_join(tids[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_mutex_destroy(&job.lock);
+    double secs = (double)(t1.tv_sec - t0.tv_sec) +
+                  (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    if (count > 0)
+        printf("Blocks %d-%d : rehashed in %.3f s on %d thread(s)\n", from,
+               bc->length - 1, secs, started);
+    if (job.first_bad >= 0) {
+        const Block *b = blockchain_block(bc, job.first_bad);
+        printf("First failure: block %u : hash=%s pow=%s link=%s "
+               "merkle=%s\n",
+               b->block_id,
+               job.first_flags & VERIFY_HASH   ? "FAIL" : "OK",
+               job.first_flags & VERIFY_POW    ? "FAIL" : "OK",
+               job.first_flags & VERIFY_LINK   ? "FAIL" : "OK",
+               job.first_flags & VERIFY_MERKLE ? "FAIL" : "OK");
+        printf("Failing blocks: %d\n", job.failures);
+    }
+    return job.first_bad < 0;
+}
+
+//the checkpoint still describes this chain if its tip block is there with
+//the same stored hash and that block still hashes to it
+static int checkpoint_matches(const Blockchain *bc,
+                              const VerifyCheckpoint *cp) {
+    if (cp->height <= 0 || cp->height > bc->length) return 0;
+    const Block *tip = blockchain_block(bc, cp->height - 1);
+    char         computed[HASH_HEX_LEN];
+    if (tip->tx_count < 0 || tip->tx_count > bc->block_txs) return 0;
+    compute_block_hash(tip, computed);
+    return strcmp(tip->hash, cp->tip_hash) == 0 &&
+           strcmp(computed, cp->tip_hash) == 0 && block_merkle_ok(tip);
+}
+
+//cp may be NULL; otherwise blocks below cp->height are skipped unless
+//full is set, and cp is moved to the tip when the chain checks out
+int blockchain_verify(const Blockchain *bc, VerifyCheckpoint *cp, int full) {
+    STAT_TIME_START(start);
     printf("\n Blockchain Integrity Verification \n");
-    printf("Difficulty : %d\n", bc->difficulty);
+    printf("Difficulty : %d bits", bc->difficulty);
+    if (bc->target_block_time > 0)
+        printf(" (retarget to %ds/block every %d blocks)",
+               bc->target_block_time, bc->retarget_window);
+    printf("\n");
     printf("Blocks     : %d\n\n", bc->length);
 
-    int ok = 1;
-    for (int i = 0; i < bc->length; i++) {
-        const Block *b = &bc->blocks[i];
-        char computed[HASH_HEX_LEN];
-      //cast away const only for compute; function doesn't modify block
-        compute_block_hash((Block *)b, computed);
-
-        int hash_ok    = (strcmp(b->hash, computed) == 0);
-        int pow_ok     = (strncmp(b->hash, prefix, bc->difficulty) == 0);
-        int link_ok    = (i == 0)
-                         ? 1
-                         : (strcmp(b->prev_hash,
-                                   bc->blocks[i-1].hash) == 0);
-
-        printf("Block %u : hash=%s pow=%s link=%s\n",
-               b->block_id,
-               hash_ok ? "OK" : "FAIL",
-               pow_ok  ? "OK" : "FAIL",
-               link_ok ? "OK" : "FAIL");
+    int from = 0;
+    if (cp && !full && cp->height > 0) {
+        if (checkpoint_matches(bc, cp)) {
+            from = cp->height;
+            printf("Blocks 0-%d : verified earlier (checkpoint tip %.16s...)"
+                   "\n", cp->height - 1, cp->tip_hash);
+        } else {
+            printf("Checkpoint at height %d no longer matches the chain; "
+                   "verifying from genesis.\n", cp->height);
+        }
+    }
 
-        if (!hash_ok || !pow_ok || !link_ok) ok = 0;
+    int ok = verify_range(bc, from);
+    if (ok && cp && bc->length > 0) {
+        cp->height = bc->length;
+        memcpy(cp->tip_hash, blockchain_tip(bc)->hash, HASH_HEX_LEN);
     }
     printf("\nVerification result: %s\n", ok ? "VALID" : "INVALID");
+    STAT_TIME_STOP(TIMER_VERIFY, start);
     return ok;
 }
 
@@ -165,7 +596,7 @@ void blockchain_print(const Blockchain *bc) {
     printf("\n BLOCKCHAIN LEDGER (%d blocks) \n",
            bc->length);
     for (int i = 0; i < bc->length; i++) {
-        const Block *b = &bc->blocks[i];
+        const Block *b = blockchain_block(bc, i);
         char tbuf[32];
         struct tm *tm = localtime(&b->timestamp);
         strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", tm);
@@ -176,6 +607,7 @@ void blockchain_print(const Blockchain *bc) {
         printf("|  Prev Hash : %.20s...\n", b->prev_hash);
         printf("|  Hash      : %.20s...\n", b->hash);
         printf("|  Nonce     : %llu\n", (unsigned long long)b->nonce);
+        printf("|  Target    : %u bits\n", b->target_bits);
         printf("|  TX count  : %d\n", b->tx_count);
 
         for (int j = 0; j < b->tx_count; j++) {
@@ -184,11 +616,14 @@ void blockchain_print(const Blockchain *bc) {
             struct tm *etm = localtime(&t->event_time);
             strftime(et, sizeof(et), "%Y-%m-%d %H:%M:%S", etm);
             printf("|   [TX %d] Type      : %s\n", j, tx_type_str(t->type));
-            printf("|          Student   : %s\n", t->student_id);
-            printf("|          Invoice   : %s\n", t->invoice_id);
-            printf("|          Amount    : %.2f RWF\n", t->amount);
-            printf("|          Balance   : %.2f RWF\n", t->balance);
-            printf("|          Reference : %s\n", t->reference);
+            printf("|          Student   : %s\n", str_get(t->student));
+            printf("|          Invoice   : %s\n", str_get(t->invoice));
+            char amt[MONEY_STR_LEN];
+            printf("|          Amount    : %s RWF\n",
+                   format_amount(t->amount, amt));
+            printf("|          Balance   : %s RWF\n",
+                   format_amount(t->balance, amt));
+            printf("|          Reference : %s\n", str_get(t->reference));
             printf("|          Confirmed : %s\n",
                    t->confirmed ? "YES" : "NO");
             printf("|          Time      : %s\n", et);
@@ -199,133 +634,267 @@ void blockchain_print(const Blockchain *bc) {
 
 
 
-int blockchain_save(const Blockchain *bc, const char *path) {
-    FILE *f = fopen(path, "wb");
-    if (!f) { perror("blockchain_save"); return 0; }
+//chain.bin had no header of its own: the difficulty (in hex zeros), the
+//number of blocks, then every block as the struct stood, with room for 8
+//transactions whose amounts were doubles
+#define BASE_BLOCK_TXS 8
 
-    //writes dificulty level plus it's length
-    fwrite(&bc->difficulty, sizeof(int),      1, f);
-    fwrite(&bc->length,     sizeof(int),      1, f);
-    fwrite(bc->blocks,      sizeof(Block), bc->length, f);
-    fclose(f);
-    return 1;
-}
+typedef struct {
+    uint32_t block_id;
+    int64_t  timestamp;
+    char     prev_hash[HASH_HEX_LEN];
+    char     hash[HASH_HEX_LEN];
+    uint64_t nonce;
+    int32_t  tx_count;
+    WideTx   transactions[BASE_BLOCK_TXS];
+} BaseBlock;
 
+//it is only read now, to import a data directory from before the chain
+//log. its hashes were taken over a text
+//rendering of the block, so they are all stale: returns 2 on success, for
+//the caller to reseal the chain (mine_reseal_chain), 0 if there is no
+//chain file and -1 if the file is not one
 int blockchain_load(Blockchain *bc, const char *path) {
     FILE *f = fopen(path, "rb");
     if (!f) return 0;   //file not fount
 
+    int  zeros = 0, length = 0;
+    long size;
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+        fseek(f, 0, SEEK_SET) != 0 ||
+        fread(&zeros, sizeof(int), 1, f) != 1 ||
+        fread(&length, sizeof(int), 1, f) != 1 ||
+        zeros < 1 || zeros * 4 > MAX_TARGET_BITS || length < 1 ||
+        (size_t)size != 2 * sizeof(int) + (size_t)length * sizeof(BaseBlock)) {
+        fclose(f);
+        return -1;
+    }
+
     memset(bc, 0, sizeof(*bc));
-    fread(&bc->difficulty, sizeof(int), 1, f);
-    fread(&bc->length,     sizeof(int), 1, f);
-    if (bc->length > MAX_BLOCKS) bc->length = MAX_BLOCKS;
-    fread(bc->blocks, sizeof(Block), bc->length, f);
+    bc->difficulty      = zeros * 4;
+    bc->retarget_window = DEFAULT_RETARGET_SPAN;
+    bc->block_txs       = BASE_BLOCK_TXS;
+
+    Block    *b = block_new(BASE_BLOCK_TXS);
+    BaseBlock old;
+    while (b && bc->length < length) {
+        if (fread(&old, sizeof(old), 1, f) != 1 || old.tx_count < 0 ||
+            old.tx_count > BASE_BLOCK_TXS)
+            break;
+        b->block_id    = old.block_id;
+        b->timestamp   = (time_t)old.timestamp;
+        memcpy(b->prev_hash, old.prev_hash, HASH_HEX_LEN);
+        memcpy(b->hash, old.hash, HASH_HEX_LEN);
+        b->prev_hash[HASH_HEX_LEN - 1] = '\0';
+        b->hash[HASH_HEX_LEN - 1]      = '\0';
+        b->nonce       = old.nonce;
+        b->target_bits = (uint32_t)bc->difficulty;
+        b->tx_count    = old.tx_count;
+        for (int i = 0; i < old.tx_count; i++)
+            tx_from_wide(&b->transactions[i], &old.transactions[i]);
+        block_set_merkle_root(b);
+        if (!blockchain_push(bc, b)) break;
+    }
+    free(b);
     fclose(f);
+    return bc->length ? 2 : -1;
+}
+
+//verify checkpoint file: magic, format version, then the checkpoint
+#define CHECKPOINT_MAGIC   "ALUVERIF"
+#define CHECKPOINT_VERSION 1
+
+int checkpoint_save(const VerifyCheckpoint *cp, const char *path) {
+    char tmp[280];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) { perror("checkpoint_save"); return 0; }
+
+    uint32_t version = CHECKPOINT_VERSION;
+    int ok = fwrite(CHECKPOINT_MAGIC, 1, 8, f) == 8 &&
+             fwrite(&version, sizeof(version), 1, f) == 1 &&
+             fwrite(cp, sizeof(*cp), 1, f) == 1;
+    if (fclose(f) != 0 || !ok || rename(tmp, path) != 0) {
+        perror("checkpoint_save");
+        remove(tmp);
+        return 0;
+    }
     return 1;
 }
 
+//a missing or unreadable checkpoint just means nothing is verified yet
+int checkpoint_load(VerifyCheckpoint *cp, const char *path) {
+    char     magic[8];
+    uint32_t version = 0;
+    memset(cp, 0, sizeof(*cp));
+
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    int ok = fread(magic, 1, 8, f) == 8 &&
+             memcmp(magic, CHECKPOINT_MAGIC, 8) == 0 &&
+             fread(&version, sizeof(version), 1, f) == 1 &&
+             version == CHECKPOINT_VERSION &&
+             fread(cp, sizeof(*cp), 1, f) == 1;
+    fclose(f);
+    if (!ok) memset(cp, 0, sizeof(*cp));
+    cp->tip_hash[HASH_HEX_LEN - 1] = '\0';
+    return ok;
+}
+
 //pending pool
 
-void pool_init(TxPool *p) {
+void pool_init(TxPool *p, int limit) {
     memset(p, 0, sizeof(*p));
+    p->limit = limit > 0 ? limit : 0;
+}
+
+void pool_free(TxPool *p) {
+    free(p->txs);
+    pool_init(p, p->limit);
+}
+
+int pool_full(const TxPool *p) {
+    return p->limit > 0 && p->count >= p->limit;
+}
+
+//double the ring, unwrapping it so the oldest transaction is in slot 0
+static int pool_grow(TxPool *p) {
+    int          cap = p->cap ? p->cap * 2 : POOL_MIN_CAP;
+    Transaction *txs = malloc((size_t)cap * sizeof(Transaction));
+    if (!txs) return 0;
+    int first = p->cap - p->head < p->count ? p->cap - p->head : p->count;
+    if (p->count) {
+        memcpy(txs, &p->txs[p->head], (size_t)first * sizeof(Transaction));
+        memcpy(txs + first, p->txs,
+               (size_t)(p->count - first) * sizeof(Transaction));
+    }
+    free(p->txs);
+    p->txs  = txs;
+    p->cap  = cap;
+    p->head = 0;
+    return 1;
 }
 
 int pool_add(TxPool *p, Transaction *tx) {
-    if (p->count >= MAX_PENDING) {
-        fprintf(stderr, "Error: pending pool full.\n");
+    if (p->count == p->cap && !pool_grow(p)) {
+        fprintf(stderr, "Error: out of memory growing the pending pool.\n");
         return 0;
     }
-    p->txs[p->count++] = *tx;
+    *pool_tx(p, p->count++) = *tx;
+    if (p->index)
+        index_add_pool(p->index, p->taken + (uint32_t)p->count - 1, tx);
+    STAT_POOL_DEPTH(p->count);
     return 1;
 }
 
 
-int pool_flush_to_block(TxPool *p, Block *b, const Blockchain *bc) {
-    if (p->count == 0) {
-        printf("No pending transactions to mine.\n");
-        return 0;
-    }
+//the next block over the oldest pending transactions; they stay in the
+//pool until the block is in the chain
+int pool_fill_block(const TxPool *p, Block *b, const Blockchain *bc) {
+    if (p->count == 0) return 0;
 
     memset(b, 0, sizeof(*b));
-    b->block_id  = (uint32_t)bc->length;
-    b->timestamp = time(NULL);
-    memcpy(b->prev_hash, bc->blocks[bc->length - 1].hash, HASH_HEX_LEN);
+    b->block_id    = (uint32_t)bc->length;
+    b->timestamp   = time(NULL);
+    b->target_bits = (uint32_t)blockchain_next_bits(bc);
+    memcpy(b->prev_hash, blockchain_tip(bc)->hash, HASH_HEX_LEN);
 
-    int take = p->count < MAX_TRANSACTIONS ? p->count : MAX_TRANSACTIONS;
+    int take = p->count < bc->block_txs ? p->count : bc->block_txs;
     for (int i = 0; i < take; i++)
-        b->transactions[i] = p->txs[i];
+        b->transactions[i] = *pool_tx(p, i);
     b->tx_count = take;
+    block_set_merkle_root(b);
+    return 1;
+}
 
- 
-    int remaining = p->count - take;
-    for (int i = 0; i < remaining; i++)
-        p->txs[i] = p->txs[i + take];
-    p->count = remaining;
+int pool_flush_to_block(TxPool *p, Block *b, const Blockchain *bc) {
+    if (!pool_fill_block(p, b, bc)) {
+        printf("No pending transactions to mine.\n");
+        return 0;
+    }
+    pool_discard(p, b->tx_count);
     return 1;
 }
 
-//invoice helpers
+//drop the first n pending transactions
+void pool_discard(TxPool *p, int n) {
+    if (n > p->count) n = p->count;
+    if (n <= 0) return;
+    if (p->index)
+        for (int i = 0; i < n; i++)
+            index_drop_pool(p->index, p->taken + (uint32_t)i, pool_tx(p, i));
+    p->head   = (p->head + n) & (p->cap - 1);
+    p->count -= n;
+    p->taken += (uint32_t)n;
+    STAT_POOL_DEPTH(p->count);
+}
+
+//invoice helpers; the string ones look the id up once, after that every
+//comparison is between handles. state comes from the index's table
+//(invoice_state), so these read one row instead of replaying the chain
 
 int invoice_exists(const Blockchain *bc, const TxPool *p,
                    const char *invoice_id) {
-    for (int i = 0; i < bc->length; i++)
-        for (int j = 0; j < bc->blocks[i].tx_count; j++)
-            if (bc->blocks[i].transactions[j].type == TX_INVOICE_CREATE &&
-                strcmp(bc->blocks[i].transactions[j].invoice_id,
-                       invoice_id) == 0)
-                return 1;
-    for (int i = 0; i < p->count; i++)
-        if (p->txs[i].type == TX_INVOICE_CREATE &&
-            strcmp(p->txs[i].invoice_id, invoice_id) == 0)
-            return 1;
-    return 0;
+    InvoiceState st;
+    return invoice_state(bc, p, str_find(invoice_id), &st);
 }
 
 int invoice_settled(const Blockchain *bc, const char *invoice_id) {
-    for (int i = 0; i < bc->length; i++)
-        for (int j = 0; j < bc->blocks[i].tx_count; j++)
-            if (bc->blocks[i].transactions[j].type == TX_INVOICE_SETTLE &&
-                strcmp(bc->blocks[i].transactions[j].invoice_id,
-                       invoice_id) == 0)
-                return 1;
-    return 0;
+    InvoiceState st;
+    invoice_state(bc, NULL, str_find(invoice_id), &st);
+    return st.settled;
 }
 
-
-double get_balance(const Blockchain *bc, const TxPool *p,
+//mined events first, then the pending pool
+int64_t get_balance(const Blockchain *bc, const TxPool *p,
                    const char *invoice_id) {
-    double balance  = -1.0;
-    int    found    = 0;
+    InvoiceState st;
+    return invoice_state(bc, p, str_find(invoice_id), &st) ? st.balance : -1;
+}
 
-    /* Chain */
-    for (int i = 0; i < bc->length; i++) {
-        for (int j = 0; j < bc->blocks[i].tx_count; j++) {
-            Transaction *t = (Transaction *)&bc->blocks[i].transactions[j];
-            if (strcmp(t->invoice_id, invoice_id) != 0) continue;
-            if (t->type == TX_INVOICE_CREATE) {
-                balance = t->amount;
-                found   = 1;
-            } else if (t->type == TX_PAYMENT_MADE ||
-                       t->type == TX_INVOICE_SETTLE) {
-                balance = t->balance;
-            }
-        }
-    }
+//a mined payment is confirmed by a later PAYMENT_CONFIRM carrying the
+//same invoice and post-payment balance (balances strictly decrease, so
+//that pair names exactly one payment)
+int payment_is_confirmed(const Blockchain *bc, const TxPool *p,
+                         const Transaction *pay) {
+    EventCursor        c;
+    const Transaction *t;
+    if (pay->confirmed) return 1;
+    invoice_events_begin(&c, bc, p, pay->invoice);
+    while ((t = invoice_events_next(&c, NULL)) != NULL)
+        if (t->type == TX_PAYMENT_CONFIRM && t->balance == pay->balance)
+            return 1;
+    return 0;
+}
 
-  
-    for (int i = 0; i < p->count; i++) {
-        Transaction *t = &p->txs[i];
-        if (strcmp(t->invoice_id, invoice_id) != 0) continue;
-        if (t->type == TX_INVOICE_CREATE) {
-            balance = t->amount;
-            found   = 1;
-        } else if (t->type == TX_PAYMENT_MADE ||
-                   t->type == TX_INVOICE_SETTLE) {
-            balance = t->balance;
-        }
+//fills up to cap rows and returns the number of invoices the student
+//has; *outstanding totals all of them, not just the rows returned
+int student_ledger(const Blockchain *bc, const TxPool *p,
+                   const char *student_id, InvoiceSummary *out, int cap,
+                   int64_t *outstanding) {
+    StudentCursor c;
+    StrId         invoice;
+    int           n     = 0;
+    int64_t       total = 0;
+
+    student_invoices_begin(&c, bc, p, str_find(student_id));
+    while ((invoice = student_invoices_next(&c)) != STR_NONE) {
+        InvoiceState   st;
+        InvoiceSummary row;
+        memset(&row, 0, sizeof(row));
+        snprintf(row.invoice_id, sizeof(row.invoice_id), "%s",
+                 str_get(invoice));
+        invoice_state(bc, p, invoice, &st);
+        row.amount  = st.amount;
+        row.balance = st.balance;
+        row.settled = st.settled;
+
+        total += row.balance;
+        if (n < cap) out[n] = row;
+        n++;
     }
-
-    return found ? balance : -1.0;
+    if (outstanding) *outstanding = total;
+    return n;
 }
 
 //input validation
@@ -344,6 +913,36 @@ int validate_invoice_id(const char *s) {
     return 1;
 }
 
-int validate_amount(double a) {
-    return (a > 0.0 && a < 1e10);
+int validate_amount(int64_t a) {
+    return a > 0 && a < MAX_AMOUNT;
+}
+
+int parse_amount(const char *s, int64_t *out) {
+    int64_t v = 0;
+    int     digits = 0;
+    for (; isdigit((unsigned char)*s); s++, digits++) {
+        v = v * 10 + (*s - '0');
+        if (v >= MAX_AMOUNT / MONEY_SCALE) return 0;
+    }
+    v *= MONEY_SCALE;
+    if (*s == '.') {
+        int scale = MONEY_SCALE / 10;
+        for (s++; isdigit((unsigned char)*s); s++, digits++) {
+            if (scale == 0) return 0;   /* finer than a minor unit */
+            v += (*s - '0') * scale;
+            scale /= 10;
+        }
+    }
+    if (*s != '\0' || digits == 0 || v >= MAX_AMOUNT) return 0;
+    *out = v;
+    return 1;
+}
+
+char *format_amount(int64_t v, char *buf) {
+    const char *sign = v < 0 ? "-" : "";
+    uint64_t    u    = v < 0 ? -(uint64_t)v : (uint64_t)v;
+    snprintf(buf, MONEY_STR_LEN, "%s%llu.%02llu", sign,
+             (unsigned long long)(u / MONEY_SCALE),
+             (unsigned long long)(u % MONEY_SCALE));
+    return buf;
 }
\ No newline at end of file
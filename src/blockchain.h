@@ -3,13 +3,23 @@
 
 #include <time.h>
 #include <stdint.h>
+#include <stddef.h>
+#include "strtab.h"
 
-//size
+//size; ids and references are interned (strtab.h), these only bound
+//their length
 #define HASH_HEX_LEN     65   
 #define MAX_STUDENT_ID   32
 #define MAX_INVOICE_ID   32
 #define MAX_REF          64
-#define MAX_TRANSACTIONS 8    /* transactions per block */
+//transactions per block are a chain parameter, fixed when it is created
+#define DEFAULT_BLOCK_TXS 64
+#define MAX_BLOCK_TXS     4096
+//money is counted in whole minor units (1/100 RWF) so that balances are
+//exact and compare with ==
+#define MONEY_SCALE   100
+#define MAX_AMOUNT    1000000000000LL   /* exclusive: 10^10 RWF */
+#define MONEY_STR_LEN 32
 //transaction types
 typedef enum {
     TX_INVOICE_CREATE  = 0,
@@ -18,78 +28,199 @@ typedef enum {
     TX_INVOICE_SETTLE  = 3
 } TxType;
 
-//single transaction 
+//single transaction. ids and the reference are string table handles, so
+//comparing them is comparing integers and a transaction is 40 bytes
 typedef struct {
-    TxType  type;
+    uint16_t type;             /* TxType */
+    uint16_t confirmed;
+    StrId    student;
+    StrId    invoice;
+    StrId    reference;
+    int64_t  amount;           /* minor units */
+    int64_t  balance;          /* minor units */
+    time_t   event_time;
+} Transaction;
+
+//a transaction as the first chain.bin and pending.bin held it: strings
+//inline and amounts as doubles
+typedef struct {
+    int32_t type;
     char    student_id[MAX_STUDENT_ID];
     char    invoice_id[MAX_INVOICE_ID];
-    double  amount;            
-    double  balance;           
+    double  amount;
+    double  balance;
     char    reference[MAX_REF];
-    time_t  event_time;
-    int     confirmed;        
-} Transaction;
+    int64_t event_time;
+    int32_t confirmed;
+} WideTx;
 
-//block
+//block: the header, then only as many transactions as it holds, both in
+//memory and in the chain log. a Block declared by value has room for no
+//transactions; use block_new for one that does
 typedef struct {
     uint32_t    block_id;
     time_t      timestamp;
     char        prev_hash[HASH_HEX_LEN];
+    char        merkle_root[HASH_HEX_LEN];   /* over the transactions */
     char        hash[HASH_HEX_LEN];
     uint64_t    nonce;
+    uint32_t    target_bits;   /* leading zero bits this block's hash needs */
     int         tx_count;
-    Transaction transactions[MAX_TRANSACTIONS];
+    Transaction transactions[];
 } Block;
 
-//blockchain in memory
-#define MAX_BLOCKS 1024
+//bytes taken by a block holding n transactions
+#define BLOCK_BYTES(n) (offsetof(Block, transactions) + \
+                        (size_t)(n) * sizeof(Transaction))
+
+//blockchain in memory: a table of Block* by height. blocks pushed by copy
+//are packed into arena chunks that never move, so a Block* stays valid
+//while the chain grows; blocks can also be pushed by reference (e.g.
+//straight out of an mmap of the chain log) when their owner keeps them
+//alive as long as the chain
+#define BLOCK_ARENA_CHUNK (256 * 1024)
+
+//proof of work is counted in leading zero bits of the raw digest
+#define MIN_TARGET_BITS       1
+#define MAX_TARGET_BITS       64
+#define DEFAULT_RETARGET_SPAN 16
+#define MAX_RETARGET_STEP     2    /* bits per adjustment, either way */
 
 typedef struct {
-    Block    blocks[MAX_BLOCKS];
+    const Block **blocks;
     int      length;
-    int      difficulty;   
+    int      block_cap;          /* slots in blocks */
+    uint8_t **chunks;
+    int      chunk_count;
+    int      chunk_cap;
+    size_t   chunk_used;         /* bytes used in the newest chunk */
+    size_t   chunk_size;         /* size of the newest chunk */
+    int      block_txs;          /* most transactions a block may hold */
+    int      difficulty;         /* target bits of the genesis block */
+    int      target_block_time;  /* seconds, 0 = fixed difficulty */
+    int      retarget_window;    /* blocks between adjustments */
+    struct LedgerIndex *index;   /* kept current by blockchain_push, or NULL */
 } Blockchain;
 
-//pending transaction pool
-#define MAX_PENDING 64
+//blocks below height were verified and block height-1 had this hash
+typedef struct {
+    int  height;
+    char tip_hash[HASH_HEX_LEN];
+} VerifyCheckpoint;
+
+//pending transaction pool: a ring buffer that doubles when it runs out of
+//room. limit is how many transactions may wait at once (0 = no limit);
+//pool_add still accepts past it, so a producer that finds the pool full
+//is expected to mine a block first rather than drop anything
+#define DEFAULT_POOL_LIMIT 1024
+#define POOL_MIN_CAP       64
 
 typedef struct {
-    Transaction txs[MAX_PENDING];
-    int         count;
+    Transaction *txs;
+    int          head;           /* slot of the oldest transaction */
+    int          count;
+    int          cap;            /* slots allocated, a power of two */
+    int          limit;
+    uint32_t     taken;          /* transactions ever removed from the head */
+    struct LedgerIndex *index;   /* kept current by pool_add, or NULL */
 } TxPool;
 
+//i-th oldest pending transaction, 0 <= i < count
+static inline Transaction *pool_tx(const TxPool *p, int i) {
+    return &p->txs[(p->head + i) & (p->cap - 1)];
+}
+
+//binary layouts (integers little-endian). ids are written out as the
+//strings, not their handles, so hashes do not depend on the string table
+//  transaction: type u32 | student_id | invoice_id | amount i64
+//               | balance i64 | reference | event_time i64 | confirmed u32
+//  block header, the part that gets hashed: block_id u32 | timestamp i64
+//               | prev_hash 32 raw bytes | merkle_root 32 raw bytes
+//               | target_bits u32 | tx_count u32 | nonce u64
+//the transactions are covered by merkle_root (see merkle.h); the nonce is
+//always the final 8 bytes so mining can reuse the midstate
+#define TX_SER_LEN       (4 + MAX_STUDENT_ID + MAX_INVOICE_ID + 8 + 8 + \
+                          MAX_REF + 8 + 4)
+#define BLOCK_HEADER_LEN (4 + 8 + 32 + 32 + 4 + 4 + 8)
+
 //function prototypes
 
-void compute_block_hash(Block *b, char *out_hex);
+Block *block_new(int tx_cap);
+size_t tx_serialize(const Transaction *t, uint8_t *out);
+//the reverse, interning the ids; returns 0 for a malformed record
+int    tx_deserialize(const uint8_t *in, Transaction *t);
+//interns a WideTx's strings and converts its amounts to minor units
+void   tx_from_wide(Transaction *t, const WideTx *w);
+size_t block_serialize(const Block *b, uint8_t *out);
+void compute_block_hash(const Block *b, char *out_hex);
+void block_set_merkle_root(Block *b);
+int  block_merkle_ok(const Block *b);
+int  hash_meets_target(const uint8_t *digest, int bits);
+int  hex_meets_target(const char *hex, int bits);
 
 //chain
 void    blockchain_init(Blockchain *bc, int difficulty);
+void    blockchain_free(Blockchain *bc);
+int     blockchain_push(Blockchain *bc, const Block *b);
+int     blockchain_push_ref(Blockchain *bc, const Block *b);
+const Block *blockchain_block(const Blockchain *bc, int index);
+const Block *blockchain_tip(const Blockchain *bc);
+void    blockchain_set_retarget(Blockchain *bc, int block_time, int window);
+void    blockchain_set_block_txs(Blockchain *bc, int txs);
+int     blockchain_bits_at(const Blockchain *bc, int height);
+int     blockchain_next_bits(const Blockchain *bc);
+int     blockchain_check_mined_block(const Blockchain *bc, const Block *b);
 int     blockchain_add_mined_block(Blockchain *bc, Block *b);
-int     blockchain_verify(const Blockchain *bc);
+int     blockchain_verify(const Blockchain *bc, VerifyCheckpoint *cp,
+                          int full);
 void    blockchain_print(const Blockchain *bc);
 
-//mining
-int     mine_block(Block *b, int difficulty);
-
 //persistence
-int     blockchain_save(const Blockchain *bc, const char *path);
 int     blockchain_load(Blockchain *bc, const char *path);
+int     checkpoint_save(const VerifyCheckpoint *cp, const char *path);
+int     checkpoint_load(VerifyCheckpoint *cp, const char *path);
 
 //pool
-void    pool_init(TxPool *p);
+void    pool_init(TxPool *p, int limit);
+void    pool_free(TxPool *p);
+int     pool_full(const TxPool *p);
 int     pool_add(TxPool *p, Transaction *tx);
+//b needs room for bc->block_txs transactions. fill leaves them pending,
+//flush takes them off the pool
+int     pool_fill_block(const TxPool *p, Block *b, const Blockchain *bc);
 int     pool_flush_to_block(TxPool *p, Block *b, const Blockchain *bc);
+void    pool_discard(TxPool *p, int n);
 
-//invoice helpers
-double  get_balance(const Blockchain *bc, const TxPool *p,
+//invoice helpers; get_balance is -1 for an unknown invoice
+int64_t get_balance(const Blockchain *bc, const TxPool *p,
                     const char *invoice_id);
 int     invoice_exists(const Blockchain *bc, const TxPool *p,
                        const char *invoice_id);
 int     invoice_settled(const Blockchain *bc, const char *invoice_id);
+int     payment_is_confirmed(const Blockchain *bc, const TxPool *p,
+                             const Transaction *pay);
+
+//student ledger: one row per invoice, pending events included
+typedef struct {
+    char    invoice_id[MAX_INVOICE_ID];
+    int64_t amount;     /* invoiced */
+    int64_t balance;    /* outstanding */
+    int     settled;
+} InvoiceSummary;
+
+int     student_ledger(const Blockchain *bc, const TxPool *p,
+                       const char *student_id, InvoiceSummary *out, int cap,
+                       int64_t *outstanding);
 
 //validation
 int  validate_student_id(const char *s);
 int  validate_invoice_id(const char *s);
-int  validate_amount(double a);
+int  validate_amount(int64_t a);
+
+//amounts as text: "1500", "1500.5" or "1500.50", no sign or exponent.
+//parse returns 0 for anything else or more than MAX_AMOUNT; format
+//writes "1500.50" to buf (MONEY_STR_LEN bytes) and returns it
+int   parse_amount(const char *s, int64_t *out);
+char *format_amount(int64_t v, char *buf);
 
 #endif
\ No newline at end of file
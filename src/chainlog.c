@@ -0,0 +1,952 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "chainlog.h"
+#include "stats.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CHAINLOG_MAGIC "ALUCHLOG"
+#define POOLLOG_MAGIC  "ALUPLWAL"
+#define CHAINIDX_MAGIC "ALUCHIDX"
+//only the current version of either log is read; a data directory from
+//before them is imported from chain.bin (blockchain_load)
+#define CHAINLOG_VERSION 4
+#define POOLLOG_VERSION  3
+
+//everything in either log is a fixed-width little-endian field, written
+//and read one field at a time
+
+//32-byte file header; params are chain parameters for the chain log
+//(difficulty, block time, retarget window, transactions per block) and
+//the base height for the pool log
+#define LOG_HEADER_LEN 32
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;   /* block header, or a pool log transaction */
+    int32_t  params[4];
+} LogHeader;
+
+//pool log records: op byte padded to 8, then the operation's data
+enum { POOL_OP_ADD = 1, POOL_OP_CONFIRM = 2, POOL_OP_TAKE = 3 };
+#define POOL_OP_HDR 8
+#define POOL_REC_MAX (POOL_OP_HDR + TX_SER_LEN)
+
+//a block record is the block header at the offsets below, then its
+//tx_count transactions of REC_TX_LEN bytes each, with every gap zeroed.
+//these are the offsets a Block and a Transaction have in memory on a
+//64-bit little-endian host, so there a record can be served from the
+//map as it is (rec_mappable); anywhere else the log is read and decoded
+#define REC_BLOCK_ID     0
+#define REC_TIMESTAMP    8
+#define REC_PREV_HASH    16
+#define REC_MERKLE_ROOT  81
+#define REC_HASH         146
+#define REC_NONCE        216
+#define REC_TARGET_BITS  224
+#define REC_TX_COUNT     228
+#define REC_HDR_LEN      232
+
+#define REC_TX_TYPE      0
+#define REC_TX_CONFIRMED 2
+#define REC_TX_STUDENT   4
+#define REC_TX_INVOICE   8
+#define REC_TX_REFERENCE 12
+#define REC_TX_AMOUNT    16
+#define REC_TX_BALANCE   24
+#define REC_TX_TIME      32
+#define REC_TX_LEN       40
+
+#define REC_BYTES(n) (REC_HDR_LEN + (size_t)(n) * REC_TX_LEN)
+
+//after the transactions come the strings whose handles appear in the
+//log for the first time in the block: u32 count, then for each a u32
+//handle, u32 length and the bytes, zero padded to a multiple of 8 so
+//the next record stays aligned for the map
+#define STR_ENTRY_MAX        (8 + MAX_REF)
+#define STR_SECTION_MAX(n)   (4 + (size_t)(n) * 3 * STR_ENTRY_MAX + 8)
+
+//crc32 (IEEE 802.3, reflected)
+static uint32_t       crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32(const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint32_t c = 0xFFFFFFFFu;
+    pthread_once(&crc_once, crc_init);
+    while (len--) c = crc_table[(c ^ *p++) & 0xff] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+//little-endian fields
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) v = v << 8 | p[i];
+    return v;
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = v << 8 | p[i];
+    return v;
+}
+
+//raw record io
+
+static int write_record(FILE *f, const void *payload, uint32_t len) {
+    uint8_t hdr[8];
+    put_u32(hdr, len);
+    put_u32(hdr + 4, crc32(payload, len));
+    return fwrite(hdr, sizeof(hdr), 1, f) == 1 &&
+           fwrite(payload, 1, len, f) == len;
+}
+
+//1 = record read, 0 = clean end of file, -1 = torn or corrupt record;
+//*len is the declared length even then, 0 if the header itself is short
+static int read_record(FILE *f, void *buf, uint32_t cap, uint32_t *len) {
+    uint8_t hdr[8];
+    size_t  got = fread(hdr, 1, sizeof(hdr), f);
+    *len = 0;
+    if (got == 0 && feof(f)) return 0;
+    if (got < sizeof(hdr)) return -1;
+    uint32_t n = *len = get_u32(hdr);
+    if (n > cap || fread(buf, 1, n, f) != n) return -1;
+    if (crc32(buf, n) != get_u32(hdr + 4)) return -1;
+    return 1;
+}
+
+//a bad record is a torn tail only if it runs to the end of the file: one
+//with records after it is damage that truncating would throw away
+static int runs_to_end(FILE *f, long at, uint32_t len) {
+    fseek(f, 0, SEEK_END);
+    return at + 8 + (long)len >= ftell(f);
+}
+
+//cut a torn tail back to the end of the last complete record
+static int truncate_tail(FILE *f, long good, const char *path) {
+    fseek(f, 0, SEEK_END);
+    long end = ftell(f);
+    fflush(f);
+    if (ftruncate(fileno(f), good) != 0) {
+        perror("truncate_tail");
+        return 0;
+    }
+    fseek(f, good, SEEK_SET);
+    fprintf(stderr, "Warning: %s: dropped %ld byte(s) of torn tail.\n",
+            path, end - good);
+    return 1;
+}
+
+static int read_header(FILE *f, const char *magic, uint32_t version,
+                       uint32_t record_size, LogHeader *h) {
+    uint8_t buf[LOG_HEADER_LEN];
+    if (fread(buf, sizeof(buf), 1, f) != 1) return 0;
+    memcpy(h->magic, buf, 8);
+    h->version     = get_u32(buf + 8);
+    h->record_size = get_u32(buf + 12);
+    for (int i = 0; i < 4; i++)
+        h->params[i] = (int32_t)get_u32(buf + 16 + 4 * i);
+    return memcmp(h->magic, magic, 8) == 0 && h->version == version &&
+           h->record_size == record_size;
+}
+
+//new logs are written to <path>.tmp and renamed into place once durable
+static FILE *begin_create(const char *path, char *tmp, size_t cap,
+                          const LogHeader *h) {
+    snprintf(tmp, cap, "%s.tmp", path);
+    FILE *f = fopen(tmp, "w+b");
+    if (!f) { perror("log create"); return NULL; }
+    uint8_t buf[LOG_HEADER_LEN];
+    memcpy(buf, h->magic, 8);
+    put_u32(buf + 8, h->version);
+    put_u32(buf + 12, h->record_size);
+    for (int i = 0; i < 4; i++)
+        put_u32(buf + 16 + 4 * i, (uint32_t)h->params[i]);
+    if (fwrite(buf, sizeof(buf), 1, f) != 1) {
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+static int finish_create(FILE *f, const char *tmp, const char *path) {
+    if (fflush(f) != 0 || fsync(fileno(f)) != 0 || rename(tmp, path) != 0) {
+        perror("log create");
+        fclose(f);
+        remove(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+//LogFile: group commit
+
+static void *log_syncer(void *arg) {
+    LogFile *lf = arg;
+
+    pthread_mutex_lock(&lf->lock);
+    while (!lf->stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec  += lf->sync_ms / 1000;
+        ts.tv_nsec += (long)(lf->sync_ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&lf->wake, &lf->lock, &ts);
+        if (lf->dirty) {
+            fsync(fileno(lf->f));
+            lf->dirty = 0;
+        }
+    }
+    pthread_mutex_unlock(&lf->lock);
+    return NULL;
+}
+
+static void log_attach(LogFile *lf, FILE *f, const char *path, int sync_ms) {
+    memset(lf, 0, sizeof(*lf));
+    lf->f       = f;
+    lf->sync_ms = sync_ms > 0 ? sync_ms : 0;
+    snprintf(lf->path, sizeof(lf->path), "%s", path);
+    pthread_mutex_init(&lf->lock, NULL);
+    pthread_cond_init(&lf->wake, NULL);
+    if (lf->sync_ms > 0 &&
+        pthread_create(&lf->syncer, NULL, log_syncer, lf) == 0)
+        lf->has_syncer = 1;
+    else
+        lf->sync_ms = 0;   /* no syncer thread: fsync every append */
+}
+
+//flush records written under the lock, then fsync them or leave them to
+//the syncer; ok says whether the writes themselves succeeded
+static int log_commit(LogFile *lf, int ok) {
+    ok = ok && fflush(lf->f) == 0;
+    if (ok) {
+        if (lf->sync_ms == 0) ok = fsync(fileno(lf->f)) == 0;
+        else                  lf->dirty = 1;
+    }
+    return ok;
+}
+
+static int log_append(LogFile *lf, const void *payload, uint32_t len) {
+    pthread_mutex_lock(&lf->lock);
+    int ok = log_commit(lf, write_record(lf->f, payload, len));
+    pthread_mutex_unlock(&lf->lock);
+    if (!ok) perror(lf->path);
+    return ok;
+}
+
+static void log_detach(LogFile *lf) {
+    if (!lf->f) return;
+    if (lf->has_syncer) {
+        pthread_mutex_lock(&lf->lock);
+        lf->stop = 1;
+        pthread_cond_signal(&lf->wake);
+        pthread_mutex_unlock(&lf->lock);
+        pthread_join(lf->syncer, NULL);
+    }
+    if (lf->dirty) fsync(fileno(lf->f));
+    fclose(lf->f);
+    pthread_cond_destroy(&lf->wake);
+    pthread_mutex_destroy(&lf->lock);
+    lf->f = NULL;
+}
+
+//chain log
+
+//record offsets, collected while reading or checking the log
+typedef struct {
+    uint64_t *at;
+    int       count;
+    int       cap;
+} Offsets;
+
+static int offsets_add(Offsets *o, uint64_t off) {
+    if (o->count == o->cap) {
+        int       cap = o->cap ? o->cap * 2 : 1024;
+        uint64_t *at  = realloc(o->at, (size_t)cap * sizeof(*at));
+        if (!at) return 0;
+        o->at  = at;
+        o->cap = cap;
+    }
+    o->at[o->count++] = off;
+    return 1;
+}
+
+static int rec_tx_count(const uint8_t *rec) {
+    return (int)(int32_t)get_u32(rec + REC_TX_COUNT);
+}
+
+//a record is a whole block: its length has to fit its tx_count, with
+//room for the string section, and its hashes have to be terminated
+static int block_record_ok(const uint8_t *rec, uint32_t len, int block_txs) {
+    if (len < REC_HDR_LEN) return 0;
+    int n = rec_tx_count(rec);
+    return n >= 0 && n <= block_txs && len % 8 == 0 &&
+           len >= REC_BYTES(n) + 4 &&
+           rec[REC_PREV_HASH + HASH_HEX_LEN - 1] == 0 &&
+           rec[REC_MERKLE_ROOT + HASH_HEX_LEN - 1] == 0 &&
+           rec[REC_HASH + HASH_HEX_LEN - 1] == 0;
+}
+
+//whether this host lays a Block out exactly as a record, so that mapped
+//records can be used as blocks without decoding them
+static int rec_mappable(void) {
+    const uint16_t one = 1;
+    return *(const uint8_t *)&one == 1 && sizeof(time_t) == 8 &&
+           sizeof(StrId) == 4 && sizeof(int) == 4 &&
+           offsetof(Block, block_id)      == REC_BLOCK_ID &&
+           offsetof(Block, timestamp)     == REC_TIMESTAMP &&
+           offsetof(Block, prev_hash)     == REC_PREV_HASH &&
+           offsetof(Block, merkle_root)   == REC_MERKLE_ROOT &&
+           offsetof(Block, hash)          == REC_HASH &&
+           offsetof(Block, nonce)         == REC_NONCE &&
+           offsetof(Block, target_bits)   == REC_TARGET_BITS &&
+           offsetof(Block, tx_count)      == REC_TX_COUNT &&
+           offsetof(Block, transactions)  == REC_HDR_LEN &&
+           offsetof(Transaction, type)      == REC_TX_TYPE &&
+           offsetof(Transaction, confirmed) == REC_TX_CONFIRMED &&
+           offsetof(Transaction, student)   == REC_TX_STUDENT &&
+           offsetof(Transaction, invoice)   == REC_TX_INVOICE &&
+           offsetof(Transaction, reference) == REC_TX_REFERENCE &&
+           offsetof(Transaction, amount)    == REC_TX_AMOUNT &&
+           offsetof(Transaction, balance)   == REC_TX_BALANCE &&
+           offsetof(Transaction, event_time) == REC_TX_TIME &&
+           sizeof(Transaction) == REC_TX_LEN;
+}
+
+//a hash string, zero padded to its full width
+static void put_hex(uint8_t *p, const char *hex) {
+    size_t n = strnlen(hex, HASH_HEX_LEN - 1);
+    memcpy(p, hex, n);
+    memset(p + n, 0, HASH_HEX_LEN - n);
+}
+
+//the block and its transactions into rec (REC_BYTES(tx_count) bytes)
+static void rec_put_block(uint8_t *rec, const Block *b) {
+    memset(rec, 0, REC_HDR_LEN);
+    put_u32(rec + REC_BLOCK_ID, b->block_id);
+    put_u64(rec + REC_TIMESTAMP, (uint64_t)(int64_t)b->timestamp);
+    put_hex(rec + REC_PREV_HASH, b->prev_hash);
+    put_hex(rec + REC_MERKLE_ROOT, b->merkle_root);
+    put_hex(rec + REC_HASH, b->hash);
+    put_u64(rec + REC_NONCE, b->nonce);
+    put_u32(rec + REC_TARGET_BITS, b->target_bits);
+    put_u32(rec + REC_TX_COUNT, (uint32_t)b->tx_count);
+    for (int i = 0; i < b->tx_count; i++) {
+        const Transaction *t = &b->transactions[i];
+        uint8_t           *p = rec + REC_BYTES(i);
+        put_u16(p + REC_TX_TYPE, t->type);
+        put_u16(p + REC_TX_CONFIRMED, t->confirmed);
+        put_u32(p + REC_TX_STUDENT, t->student);
+        put_u32(p + REC_TX_INVOICE, t->invoice);
+        put_u32(p + REC_TX_REFERENCE, t->reference);
+        put_u64(p + REC_TX_AMOUNT, (uint64_t)t->amount);
+        put_u64(p + REC_TX_BALANCE, (uint64_t)t->balance);
+        put_u64(p + REC_TX_TIME, (uint64_t)(int64_t)t->event_time);
+    }
+}
+
+//the reverse, into b with room for the record's tx_count (checked by
+//block_record_ok)
+static void rec_get_block(const uint8_t *rec, Block *b) {
+    b->block_id    = get_u32(rec + REC_BLOCK_ID);
+    b->timestamp   = (time_t)(int64_t)get_u64(rec + REC_TIMESTAMP);
+    memcpy(b->prev_hash, rec + REC_PREV_HASH, HASH_HEX_LEN);
+    memcpy(b->merkle_root, rec + REC_MERKLE_ROOT, HASH_HEX_LEN);
+    memcpy(b->hash, rec + REC_HASH, HASH_HEX_LEN);
+    b->nonce       = get_u64(rec + REC_NONCE);
+    b->target_bits = get_u32(rec + REC_TARGET_BITS);
+    b->tx_count    = rec_tx_count(rec);
+    for (int i = 0; i < b->tx_count; i++) {
+        Transaction   *t = &b->transactions[i];
+        const uint8_t *p = rec + REC_BYTES(i);
+        t->type       = get_u16(p + REC_TX_TYPE);
+        t->confirmed  = get_u16(p + REC_TX_CONFIRMED);
+        t->student    = get_u32(p + REC_TX_STUDENT);
+        t->invoice    = get_u32(p + REC_TX_INVOICE);
+        t->reference  = get_u32(p + REC_TX_REFERENCE);
+        t->amount     = (int64_t)get_u64(p + REC_TX_AMOUNT);
+        t->balance    = (int64_t)get_u64(p + REC_TX_BALANCE);
+        t->event_time = (time_t)(int64_t)get_u64(p + REC_TX_TIME);
+    }
+}
+
+//strings the log holds, by handle
+static int logged(const ChainLog *log, StrId id) {
+    return id < log->logged_cap && (log->logged[id / 8] >> (id % 8) & 1);
+}
+
+static int mark_logged(ChainLog *log, StrId id, int on) {
+    if (id >= log->logged_cap) {
+        uint32_t cap = log->logged_cap ? log->logged_cap : 8192;
+        while (cap <= id) cap *= 2;
+        uint8_t *bits = realloc(log->logged, cap / 8);
+        if (!bits) return 0;
+        memset(bits + log->logged_cap / 8, 0, (cap - log->logged_cap) / 8);
+        log->logged     = bits;
+        log->logged_cap = cap;
+    }
+    if (on) log->logged[id / 8] |=  (uint8_t)(1u << (id % 8));
+    else    log->logged[id / 8] &= (uint8_t)~(1u << (id % 8));
+    return 1;
+}
+
+//put a record's strings back in the string table under their handles;
+//0 if the section is malformed or disagrees with strings already loaded
+static int load_strings(ChainLog *log, const uint8_t *rec, uint32_t len) {
+    const uint8_t *p     = rec + REC_BYTES(rec_tx_count(rec));
+    const uint8_t *end   = rec + len;
+    uint32_t       count = get_u32(p), id, n;
+
+    p += 4;
+    while (count--) {
+        if (end - p < 8) return 0;
+        id = get_u32(p);
+        n  = get_u32(p + 4);
+        p += 8;
+        if (n >= MAX_REF || (uint32_t)(end - p) < n ||
+            !str_load(id, (const char *)p, n) || !mark_logged(log, id, 1))
+            return 0;
+        p += n;
+    }
+    return end - p < 8;
+}
+
+//add id's string to the section at *p unless the log already has it
+static int section_add(ChainLog *log, uint8_t **p, uint32_t *count,
+                       StrId id) {
+    if (id == STR_NONE || logged(log, id)) return 1;
+    if (!mark_logged(log, id, 1)) return 0;
+    const char *s = str_get(id);
+    uint32_t    n = (uint32_t)strlen(s);
+    put_u32(*p, id);
+    put_u32(*p + 4, n);
+    memcpy(*p + 8, s, n);
+    *p += 8 + n;
+    (*count)++;
+    return 1;
+}
+
+//the section in log->buf did not reach the log after all
+static void unmark_section(ChainLog *log) {
+    const uint8_t *p     = log->buf + REC_BYTES(rec_tx_count(log->buf));
+    uint32_t       count = get_u32(p), n;
+    for (p += 4; count--; p += 8 + n) {
+        n = get_u32(p + 4);
+        mark_logged(log, get_u32(p), 0);
+    }
+}
+
+//build b's record in log->buf and return its length, 0 if out of
+//memory; the strings it carries are marked as logged up front
+static uint32_t block_record(ChainLog *log, const Block *b) {
+    size_t need = REC_BYTES(b->tx_count) + STR_SECTION_MAX(b->tx_count);
+    if (need > log->buf_cap) {
+        uint8_t *buf = realloc(log->buf, need);
+        if (!buf) return 0;
+        log->buf     = buf;
+        log->buf_cap = need;
+    }
+    rec_put_block(log->buf, b);
+
+    uint8_t *sec   = log->buf + REC_BYTES(b->tx_count);
+    uint8_t *p     = sec + 4;
+    uint32_t count = 0;
+    for (int i = 0; i < b->tx_count; i++) {
+        const Transaction *t = &b->transactions[i];
+        if (!section_add(log, &p, &count, t->student) ||
+            !section_add(log, &p, &count, t->invoice) ||
+            !section_add(log, &p, &count, t->reference)) {
+            put_u32(sec, count);
+            unmark_section(log);
+            return 0;
+        }
+    }
+    put_u32(sec, count);
+    while ((size_t)(p - log->buf) % 8) *p++ = 0;
+    return (uint32_t)(p - log->buf);
+}
+
+static void chainlog_free_buffers(ChainLog *log) {
+    free(log->logged);
+    free(log->buf);
+    log->logged     = NULL;
+    log->logged_cap = 0;
+    log->buf        = NULL;
+    log->buf_cap    = 0;
+}
+
+//offset index: <log>.idx holds the magic, then the file offset of every
+//record as a u64. it is only a hint for opening mapped, flushed but never
+//synced; anything that does not line up with the log is rebuilt from it
+static void idx_close(ChainLog *log) {
+    if (log->idx) fclose(log->idx);
+    log->idx = NULL;
+}
+
+//a stale index only costs the next mapped open a full read: drop it
+static void idx_drop(ChainLog *log) {
+    idx_close(log);
+    remove(log->idx_path);
+}
+
+static void idx_write(ChainLog *log, const Offsets *o) {
+    idx_close(log);
+    log->idx = fopen(log->idx_path, "wb");
+    if (!log->idx) return;
+    if (fwrite(CHAINIDX_MAGIC, 1, 8, log->idx) != 8 ||
+        fwrite(o->at, sizeof(uint64_t), (size_t)o->count, log->idx) !=
+            (size_t)o->count ||
+        fflush(log->idx) != 0)
+        idx_drop(log);
+}
+
+static void idx_append(ChainLog *log, uint64_t off) {
+    if (!log->idx) return;
+    if (fwrite(&off, sizeof(off), 1, log->idx) != 1 ||
+        fflush(log->idx) != 0)
+        idx_drop(log);
+}
+
+//keep the index if it has one entry per record, else rewrite it
+static void idx_sync(ChainLog *log, const Offsets *o) {
+    struct stat st;
+    if (stat(log->idx_path, &st) == 0 &&
+        (size_t)st.st_size == 8 + (size_t)o->count * sizeof(uint64_t)) {
+        log->idx = fopen(log->idx_path, "ab");
+        if (log->idx) return;
+    }
+    idx_write(log, o);
+}
+
+static int idx_read(const char *path, Offsets *o) {
+    FILE *f = fopen(path, "rb");
+    char  magic[8];
+    if (!f) return 0;
+    int ok = fread(magic, 1, 8, f) == 8 &&
+             memcmp(magic, CHAINIDX_MAGIC, 8) == 0;
+    uint64_t off;
+    while (ok && fread(&off, sizeof(off), 1, f) == 1)
+        ok = offsets_add(o, off);
+    fclose(f);
+    return ok;
+}
+
+//mapped open: the index says where every block is, so the blocks are
+//pushed by reference straight out of a read-only map of the whole file
+//and never copied. each record's length and string section are read to
+//load the string table, except for the first `known` records, whose
+//strings came from a state snapshot: of those only the block part is
+//checked, so their string sections are not even paged in. only the
+//newest record's checksum is checked here, 'chain verify' recomputes
+//every hash anyway.
+//returns 0 if the index does not line up with the log, for the caller to
+//fall back to a read
+static int chainlog_open_mapped(ChainLog *log, FILE *f, Blockchain *bc,
+                                int known) {
+    Offsets     o;
+    struct stat st;
+
+    memset(&o, 0, sizeof(o));
+    if (fstat(fileno(f), &st) != 0 || !idx_read(log->idx_path, &o) ||
+        o.count == 0 || o.at[0] != LOG_HEADER_LEN) {
+        free(o.at);
+        return 0;
+    }
+
+    uint64_t size = (uint64_t)st.st_size;
+    void    *addr = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED,
+                         fileno(f), 0);
+    if (addr == MAP_FAILED) {
+        free(o.at);
+        return 0;
+    }
+
+    //records have to follow each other exactly and the last ends the file
+    int ok = 1;
+    for (int i = 0; i < o.count && ok; i++) {
+        uint64_t at   = o.at[i];
+        uint64_t next = i + 1 < o.count ? o.at[i + 1] : size;
+        if (at + 8 > next || next > size) {
+            ok = 0;
+            break;
+        }
+        const uint8_t *hdr = (const uint8_t *)addr + at;
+        const uint8_t *rec = hdr + 8;
+        uint32_t       len = get_u32(hdr);
+        ok = at + 8 + len == next &&
+             block_record_ok(rec, len, bc->block_txs) &&
+             (i + 1 < o.count || get_u32(hdr + 4) == crc32(rec, len)) &&
+             (i < known || load_strings(log, rec, len)) &&
+             blockchain_push_ref(bc, (const Block *)rec);
+    }
+    free(o.at);
+    if (!ok) {
+        munmap(addr, (size_t)size);
+        blockchain_free(bc);
+        return 0;
+    }
+
+    log->map.addr = addr;
+    log->map.len  = (size_t)size;
+    log->end      = size;
+    log->idx      = fopen(log->idx_path, "ab");
+    fseek(f, 0, SEEK_END);
+    return 1;
+}
+
+//read every record; the first known records' strings are in the table
+//already
+static int chainlog_read(ChainLog *log, FILE *f, Blockchain *bc, int known) {
+    int      txs  = bc->block_txs;
+    Offsets  o;
+    Block   *blk  = block_new(txs);
+    uint32_t cap  = (uint32_t)(REC_BYTES(txs) + STR_SECTION_MAX(txs));
+    uint8_t *rec  = malloc(cap);
+    uint32_t len  = 0;
+    long     good = LOG_HEADER_LEN;
+    int      r    = 0;
+
+    memset(&o, 0, sizeof(o));
+    fseek(f, good, SEEK_SET);
+    while (blk && rec && (r = read_record(f, rec, cap, &len)) == 1) {
+        if (!block_record_ok(rec, len, bc->block_txs)) {
+            r = -1;
+            break;
+        }
+        //strings that clash with a snapshot's mean the snapshot is from
+        //another chain, not that this record is torn: leave the log be
+        int strings_ok = o.count < known || load_strings(log, rec, len);
+        if (!strings_ok && !known) {
+            r = -1;
+            break;
+        }
+        rec_get_block(rec, blk);
+        if (!strings_ok || !offsets_add(&o, (uint64_t)good) ||
+            !blockchain_push(bc, blk)) {
+            free(rec);
+            free(blk);
+            free(o.at);
+            blockchain_free(bc);
+            return 0;
+        }
+        good = ftell(f);
+    }
+    free(rec);
+    free(blk);
+    if (r < 0 && !runs_to_end(f, good, len)) {
+        fprintf(stderr, "Error: %s: block %d (byte %ld) is damaged and has "
+                        "records after it; leaving the log as it is.\n",
+                log->file.path, o.count, good);
+        free(o.at);
+        blockchain_free(bc);
+        return 0;
+    }
+    if (r < 0) truncate_tail(f, good, log->file.path);
+    else       fseek(f, 0, SEEK_END);
+
+    log->end = (uint64_t)good;
+    idx_sync(log, &o);
+    free(o.at);
+    return 1;
+}
+
+int chainlog_open(ChainLog *log, const char *path, Blockchain *bc,
+                  int sync_ms, int mapped, int known) {
+    STAT_TIME_START(start);
+    memset(log, 0, sizeof(*log));
+    snprintf(log->idx_path, sizeof(log->idx_path), "%s.idx", path);
+
+    FILE *f = fopen(path, "r+b");
+    if (!f) return 0;
+
+    LogHeader h;
+    if (!read_header(f, CHAINLOG_MAGIC, CHAINLOG_VERSION,
+                     REC_HDR_LEN, &h) ||
+        h.params[3] < 1 || h.params[3] > MAX_BLOCK_TXS) {
+        fclose(f);
+        return -1;
+    }
+
+    //the strings a snapshot put in the table are the ones its blocks
+    //brought into the log
+    for (StrId id = 1; known > 0 && id < str_limit(); id++) {
+        if (*str_get(id) && !mark_logged(log, id, 1)) {
+            fclose(f);
+            chainlog_free_buffers(log);
+            return -1;
+        }
+    }
+
+    memset(bc, 0, sizeof(*bc));
+    bc->difficulty        = h.params[0];
+    bc->target_block_time = h.params[1];
+    bc->retarget_window   = h.params[2];
+    bc->block_txs         = h.params[3];
+    snprintf(log->file.path, sizeof(log->file.path), "%s", path);
+
+    if (!(mapped && rec_mappable() &&
+          chainlog_open_mapped(log, f, bc, known)) &&
+        !chainlog_read(log, f, bc, known)) {
+        fclose(f);
+        chainlog_free_buffers(log);
+        return -1;
+    }
+    log_attach(&log->file, f, path, sync_ms);
+    STAT_TIME_STOP(TIMER_CHAIN_LOAD, start);
+    return 1;
+}
+
+int chainlog_create(ChainLog *log, const char *path, const Blockchain *bc,
+                    int sync_ms) {
+    STAT_TIME_START(start);
+    LogHeader h;
+    Offsets   o;
+    char      tmp[280];
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CHAINLOG_MAGIC, 8);
+    h.version     = CHAINLOG_VERSION;
+    h.record_size = REC_HDR_LEN;
+    h.params[0]   = bc->difficulty;
+    h.params[1]   = bc->target_block_time;
+    h.params[2]   = bc->retarget_window;
+    h.params[3]   = bc->block_txs;
+
+    memset(log, 0, sizeof(*log));
+    memset(&o, 0, sizeof(o));
+    snprintf(log->idx_path, sizeof(log->idx_path), "%s.idx", path);
+    FILE *f = begin_create(path, tmp, sizeof(tmp), &h);
+    if (!f) return 0;
+    for (int i = 0; i < bc->length; i++) {
+        const Block *b   = blockchain_block(bc, i);
+        uint32_t     len = block_record(log, b);
+        if (!len || !offsets_add(&o, (uint64_t)ftell(f)) ||
+            !write_record(f, log->buf, len)) {
+            fclose(f);
+            remove(tmp);
+            free(o.at);
+            chainlog_free_buffers(log);
+            return 0;
+        }
+    }
+    log->end = (uint64_t)ftell(f);
+    if (!finish_create(f, tmp, path)) {
+        free(o.at);
+        return 0;
+    }
+    idx_write(log, &o);
+    free(o.at);
+
+    log_attach(&log->file, f, path, sync_ms);
+    STAT_TIME_STOP(TIMER_CHAIN_SAVE, start);
+    return 1;
+}
+
+int chainlog_append(ChainLog *log, const Block *b) {
+    STAT_TIME_START(start);
+    uint32_t len = block_record(log, b);
+    if (!len) {
+        fprintf(stderr, "Error: out of memory logging block %u.\n",
+                b->block_id);
+        return 0;
+    }
+    if (!log_append(&log->file, log->buf, len)) {
+        unmark_section(log);
+        return 0;
+    }
+    idx_append(log, log->end);
+    log->end += 8 + len;
+    STAT_TIME_STOP(TIMER_CHAIN_SAVE, start);
+    return 1;
+}
+
+//blocks pushed from the map are gone after this
+void chainlog_close(ChainLog *log) {
+    log_detach(&log->file);
+    idx_close(log);
+    chainlog_free_buffers(log);
+    if (log->map.addr) munmap(log->map.addr, log->map.len);
+    log->map.addr = NULL;
+}
+
+//pool log
+
+static int pool_record(PoolLog *log, int op, const void *data, size_t len) {
+    uint8_t buf[POOL_REC_MAX];
+    memset(buf, 0, POOL_OP_HDR);
+    buf[0] = (uint8_t)op;
+    memcpy(buf + POOL_OP_HDR, data, len);
+    return log_append(&log->file, buf, (uint32_t)(POOL_OP_HDR + len));
+}
+
+//replace the log with one ADD per pending transaction, based at `base`
+static int poollog_rewrite(PoolLog *log, const char *path, const TxPool *p,
+                           int base, int sync_ms) {
+    LogHeader h;
+    char      tmp[280];
+    uint8_t   buf[POOL_OP_HDR + TX_SER_LEN];
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, POOLLOG_MAGIC, 8);
+    h.version     = POOLLOG_VERSION;
+    h.record_size = TX_SER_LEN;
+    h.params[0]   = base;
+
+    FILE *f = begin_create(path, tmp, sizeof(tmp), &h);
+    if (!f) return 0;
+    memset(buf, 0, POOL_OP_HDR);
+    buf[0] = POOL_OP_ADD;
+    for (int i = 0; i < p->count; i++) {
+        tx_serialize(pool_tx(p, i), buf + POOL_OP_HDR);
+        if (!write_record(f, buf, sizeof(buf))) {
+            fclose(f);
+            remove(tmp);
+            return 0;
+        }
+    }
+
+    log_detach(&log->file);
+    if (!finish_create(f, tmp, path)) return 0;
+    log_attach(&log->file, f, path, sync_ms);
+    log->base_height = base;
+    return 1;
+}
+
+int poollog_open(PoolLog *log, const char *path, TxPool *p,
+                 const Blockchain *bc, int sync_ms) {
+    memset(log, 0, sizeof(*log));
+
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        LogHeader h;
+        if (!read_header(f, POOLLOG_MAGIC, POOLLOG_VERSION, TX_SER_LEN, &h)) {
+            fprintf(stderr, "Error: %s is not a pending-pool log.\n", path);
+            fclose(f);
+            return 0;
+        }
+
+        int      base      = h.params[0];
+        int      last_take = base - 1;
+        uint8_t  buf[POOL_REC_MAX];
+        uint32_t len, a, b;
+        int      r;
+        while ((r = read_record(f, buf, sizeof(buf), &len)) == 1) {
+            switch (buf[0]) {
+            case POOL_OP_ADD: {
+                Transaction tx;
+                if (len != POOL_OP_HDR + TX_SER_LEN ||
+                    !tx_deserialize(buf + POOL_OP_HDR, &tx))
+                    break;
+                pool_add(p, &tx);
+                break;
+            }
+            case POOL_OP_CONFIRM:
+                a = get_u32(buf + POOL_OP_HDR);
+                if ((int)a < p->count) pool_tx(p, (int)a)->confirmed = 1;
+                break;
+            case POOL_OP_TAKE:
+                a = get_u32(buf + POOL_OP_HDR);
+                b = get_u32(buf + POOL_OP_HDR + 4);
+                pool_discard(p, (int)a);
+                last_take = (int)b;
+                break;
+            }
+        }
+        if (r < 0)
+            fprintf(stderr, "Warning: %s: ignoring torn tail record.\n",
+                    path);
+        fclose(f);
+
+        //blocks that reached the chain log before their TAKE record did
+        for (int i = last_take + 1; i < bc->length; i++)
+            if (i >= base)
+                pool_discard(p, blockchain_block(bc, i)->tx_count);
+    }
+
+    return poollog_rewrite(log, path, p, bc->length, sync_ms);
+}
+
+int poollog_add(PoolLog *log, const Transaction *tx) {
+    uint8_t ser[TX_SER_LEN];
+    return pool_record(log, POOL_OP_ADD, ser, tx_serialize(tx, ser));
+}
+
+//ADD records for pool entries first..first+n-1, flushed (and synced) once
+//for the lot
+int poollog_add_batch(PoolLog *log, const TxPool *p, int first, int n) {
+    LogFile *lf = &log->file;
+    uint8_t  buf[POOL_OP_HDR + TX_SER_LEN];
+    int      ok = 1;
+
+    memset(buf, 0, POOL_OP_HDR);
+    buf[0] = POOL_OP_ADD;
+    pthread_mutex_lock(&lf->lock);
+    for (int i = 0; i < n && ok; i++) {
+        tx_serialize(pool_tx(p, first + i), buf + POOL_OP_HDR);
+        ok = write_record(lf->f, buf, sizeof(buf));
+    }
+    ok = log_commit(lf, ok);
+    pthread_mutex_unlock(&lf->lock);
+    if (!ok) perror(lf->path);
+    return ok;
+}
+
+int poollog_confirm(PoolLog *log, int index) {
+    uint8_t i[4];
+    put_u32(i, (uint32_t)index);
+    return pool_record(log, POOL_OP_CONFIRM, i, sizeof(i));
+}
+
+//record that block b took the head of the pool; an emptied pool lets the
+//log restart from scratch at the new height
+int poollog_take(PoolLog *log, const TxPool *p, const Block *b) {
+    uint8_t data[8];
+    put_u32(data, (uint32_t)b->tx_count);
+    put_u32(data + 4, b->block_id);
+    if (p->count == 0) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s", log->file.path);
+        return poollog_rewrite(log, path, p, (int)b->block_id + 1,
+                               log->file.sync_ms);
+    }
+    return pool_record(log, POOL_OP_TAKE, data, sizeof(data));
+}
+
+void poollog_close(PoolLog *log) {
+    log_detach(&log->file);
+}
@@ -0,0 +1,84 @@
+#ifndef CHAINLOG_H
+#define CHAINLOG_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "blockchain.h"
+
+//append-only file of records: u32 payload length | u32 crc32 | payload
+//appends are flushed to the OS at once; fsync is batched over a
+//group-commit window by a background thread (sync_ms 0 = every append)
+typedef struct {
+    FILE           *f;
+    char            path[256];
+    int             sync_ms;
+    int             dirty;      /* appended since the last fsync */
+    int             stop;
+    int             has_syncer;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    pthread_t       syncer;
+} LogFile;
+
+//one record per mined block, holding the block's header and only the
+//transactions it has, then the strings of the ids and references it is
+//the first to use, so records vary in size. every field is fixed-width
+//little-endian. <path>.idx lists where each record starts; when opened
+//mapped, the chain's blocks are served straight from a read-only mmap of
+//the log found through that index. that needs a host whose Block layout
+//is the record layout (64-bit little-endian); others read the log.
+//blocks appended later are served from memory.
+//mapping saves copying blocks, not reading them: the string section of
+//every record a state snapshot does not cover is still read to fill the
+//string table, so without a snapshot the open touches the whole log
+typedef struct {
+    void   *addr;
+    size_t  len;
+} LogMap;
+
+typedef struct {
+    LogFile  file;
+    uint64_t end;              /* file offset the next record goes to */
+    FILE    *idx;              /* offset index, NULL if it could not be kept */
+    char     idx_path[264];
+    LogMap   map;              /* NULL addr unless opened mapped */
+    uint8_t *logged;           /* bit per string handle the log holds */
+    uint32_t logged_cap;       /* handles covered */
+    uint8_t *buf;              /* record being appended */
+    size_t   buf_cap;
+} ChainLog;
+
+//write-ahead log of pending pool changes since the chain was base_height
+//blocks long
+typedef struct {
+    LogFile file;
+    int     base_height;
+} PoolLog;
+
+#define DEFAULT_SYNC_MS 100
+
+//chain log: open returns 1 if loaded, 0 if missing, -1 if unreadable.
+//mapped = 1 maps the log instead of reading every record; it falls back
+//to reading when the offset index is missing or out of date. a chain
+//opened mapped must not be used after chainlog_close. known is how many
+//leading blocks a state snapshot covers, whose strings are in the string
+//table already: their string sections are skipped, and a later one that
+//clashes with them fails the open instead of being dropped as torn
+int  chainlog_open(ChainLog *log, const char *path, Blockchain *bc,
+                   int sync_ms, int mapped, int known);
+int  chainlog_create(ChainLog *log, const char *path, const Blockchain *bc,
+                     int sync_ms);
+int  chainlog_append(ChainLog *log, const Block *b);
+void chainlog_close(ChainLog *log);
+
+//pool log: open replays into p (which must be empty) and rewrites the
+//log as a compact snapshot; returns 1 on success, 0 on error
+int  poollog_open(PoolLog *log, const char *path, TxPool *p,
+                  const Blockchain *bc, int sync_ms);
+int  poollog_add(PoolLog *log, const Transaction *tx);
+int  poollog_add_batch(PoolLog *log, const TxPool *p, int first, int n);
+int  poollog_confirm(PoolLog *log, int index);
+int  poollog_take(PoolLog *log, const TxPool *p, const Block *b);
+void poollog_close(PoolLog *log);
+
+#endif
@@ -0,0 +1,589 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "index.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define INDEX_MIN_CAP 1024
+
+//arrays read from a snapshot stay in its map until they first grow
+static int borrowed(const LedgerIndex *idx, const void *p) {
+    return idx->map && (const char *)p >= (const char *)idx->map &&
+           (const char *)p < (const char *)idx->map + idx->map_len;
+}
+
+static void *grow(const LedgerIndex *idx, void *p, size_t old,
+                  size_t bytes) {
+    if (!borrowed(idx, p)) return realloc(p, bytes);
+    void *copy = malloc(bytes);
+    if (copy) memcpy(copy, p, old);
+    return copy;
+}
+
+static void release(const LedgerIndex *idx, void *p) {
+    if (!borrowed(idx, p)) free(p);
+}
+
+//id maps
+
+static int map_init(IdMap *m, void **entries, size_t stride) {
+    m->entry     = calloc(INDEX_MIN_CAP, sizeof(int32_t));
+    *entries     = malloc(INDEX_MIN_CAP * stride);
+    m->cap       = INDEX_MIN_CAP;
+    m->used      = 0;
+    m->entry_cap = INDEX_MIN_CAP;
+    return m->entry && *entries;
+}
+
+//entry number for id, or -1
+static int32_t map_find(const IdMap *m, StrId id) {
+    return id < m->cap ? m->entry[id] - 1 : -1;
+}
+
+//entry number for id, adding a zeroed entry if it is new; -1 if out of
+//memory
+static int32_t map_add(const LedgerIndex *idx, IdMap *m, void **entries,
+                       size_t stride, StrId id, int *added) {
+    *added = 0;
+    if (id < m->cap && m->entry[id] != 0) return m->entry[id] - 1;
+
+    if (id >= m->cap) {
+        uint32_t cap = m->cap;
+        while (cap <= id) cap *= 2;
+        int32_t *grown = grow(idx, m->entry, m->cap * sizeof(int32_t),
+                              cap * sizeof(int32_t));
+        if (!grown) return -1;
+        memset(grown + m->cap, 0, (cap - m->cap) * sizeof(int32_t));
+        m->entry = grown;
+        m->cap   = cap;
+    }
+    if (m->used == m->entry_cap) {
+        void *grown = grow(idx, *entries, (size_t)m->entry_cap * stride,
+                           (size_t)m->entry_cap * 2 * stride);
+        if (!grown) return -1;
+        *entries      = grown;
+        m->entry_cap *= 2;
+    }
+    int32_t n = m->used++;
+    memset((char *)*entries + (size_t)n * stride, 0, stride);
+    m->entry[id] = n + 1;
+    *added       = 1;
+    return n;
+}
+
+//index lifecycle
+
+int index_init(LedgerIndex *idx) {
+    memset(idx, 0, sizeof(*idx));
+    idx->valid =
+        map_init(&idx->invoice_map, (void **)&idx->invoices,
+                 sizeof(InvoiceEntry)) &&
+        map_init(&idx->student_map, (void **)&idx->students,
+                 sizeof(StudentEntry));
+    idx->free_event = -1;
+    return idx->valid;
+}
+
+void index_free(LedgerIndex *idx) {
+    release(idx, idx->invoice_map.entry);
+    release(idx, idx->invoices);
+    release(idx, idx->student_map.entry);
+    release(idx, idx->students);
+    release(idx, idx->events);
+    if (idx->map) munmap(idx->map, idx->map_len);
+    memset(idx, 0, sizeof(*idx));
+}
+
+//a create also files the invoice under its student
+static int link_student(LedgerIndex *idx, int32_t inv, StrId student) {
+    int     added;
+    int32_t st = map_add(idx, &idx->student_map, (void **)&idx->students,
+                         sizeof(StudentEntry), student, &added);
+    if (st < 0) return 0;
+    StudentEntry *s = &idx->students[st];
+    if (added) {
+        s->id            = student;
+        s->first_invoice = inv;
+    }
+    else
+        idx->invoices[s->last_invoice].next_invoice = inv;
+    s->last_invoice = inv;
+    idx->invoices[inv].student = st;
+    return 1;
+}
+
+//one event into s; returns 1 if it set the balance
+static int fold_event(InvoiceState *s, const Transaction *t, int32_t height,
+                      uint32_t slot) {
+    int mined = height != INDEX_POOL;
+    if (mined) {
+        s->last_height = height;
+        s->last_slot   = slot;
+    }
+    switch (t->type) {
+    case TX_INVOICE_CREATE:
+        s->created = 1;
+        s->student = t->student;
+        s->amount  = t->amount;
+        s->balance = t->amount;
+        return 1;
+    case TX_INVOICE_SETTLE:
+        if (mined) s->settled = 1;
+        s->balance = t->balance;
+        return 1;
+    case TX_PAYMENT_MADE:
+        s->balance = t->balance;
+        return 1;
+    }
+    return 0;
+}
+
+static void state_init(InvoiceState *s) {
+    memset(s, 0, sizeof(*s));
+    s->last_height = -1;
+}
+
+static void add_event(LedgerIndex *idx, const Transaction *tx,
+                      int32_t height, uint32_t slot) {
+    if (!idx->valid || tx->invoice == STR_NONE) return;
+    if (idx->free_event < 0 && idx->event_count == idx->event_cap) {
+        int32_t     cap = idx->event_cap ? idx->event_cap * 2 : 4096;
+        IndexEvent *ev  = grow(idx, idx->events,
+                               (size_t)idx->event_cap * sizeof(*ev),
+                               (size_t)cap * sizeof(*ev));
+        if (!ev) {
+            idx->valid = 0;
+            return;
+        }
+        idx->events    = ev;
+        idx->event_cap = cap;
+    }
+
+    int     added;
+    int32_t inv = map_add(idx, &idx->invoice_map, (void **)&idx->invoices,
+                          sizeof(InvoiceEntry), tx->invoice, &added);
+    if (inv < 0) {
+        idx->valid = 0;
+        return;
+    }
+    InvoiceEntry *entry = &idx->invoices[inv];
+    int32_t       e     = idx->free_event;
+    if (e >= 0) idx->free_event = idx->events[e].next;
+    else        e = idx->event_count++;
+    idx->events[e].height = height;
+    idx->events[e].slot   = slot;
+    idx->events[e].next   = -1;
+    if (added) {
+        entry->id           = tx->invoice;
+        entry->head         = e;
+        entry->student      = -1;
+        entry->next_invoice = -1;
+        state_init(&entry->chain);
+        state_init(&entry->pending);
+    } else if (entry->tail < 0) {
+        entry->head = e;   /* its only events were dropped from the pool */
+    } else {
+        idx->events[entry->tail].next = e;
+    }
+    entry->tail = e;
+
+    if (height != INDEX_POOL) {
+        fold_event(&entry->chain, tx, height, slot);
+    } else if (fold_event(&entry->pending, tx, height, slot)) {
+        entry->pending_seq = slot;
+        entry->has_pending = 1;
+    }
+
+    if (tx->type == TX_INVOICE_CREATE && entry->student < 0 &&
+        tx->student != STR_NONE && !link_student(idx, inv, tx->student))
+        idx->valid = 0;
+}
+
+void index_add_block(LedgerIndex *idx, int height, const Block *b) {
+    for (int j = 0; j < b->tx_count; j++)
+        add_event(idx, &b->transactions[j], height, (uint32_t)j);
+}
+
+void index_add_pool(LedgerIndex *idx, uint32_t seq, const Transaction *tx) {
+    add_event(idx, tx, INDEX_POOL, seq);
+}
+
+//unlink the entry's event, wherever it sits among the invoice's; it is
+//normally the oldest pool one, since the pool is mined in order
+void index_drop_pool(LedgerIndex *idx, uint32_t seq, const Transaction *tx) {
+    if (!idx->valid) return;
+    int32_t inv = map_find(&idx->invoice_map, tx->invoice);
+    if (inv < 0) return;
+
+    InvoiceEntry *entry = &idx->invoices[inv];
+    int32_t       prev  = -1;
+    for (int32_t e = entry->head; e >= 0; prev = e, e = idx->events[e].next) {
+        IndexEvent *ev = &idx->events[e];
+        if (ev->height != INDEX_POOL || ev->slot != seq) continue;
+        if (prev < 0) entry->head = ev->next;
+        else          idx->events[prev].next = ev->next;
+        if (entry->tail == e) entry->tail = prev;
+        ev->next        = idx->free_event;
+        idx->free_event = e;
+        return;
+    }
+}
+
+int index_build(LedgerIndex *idx, Blockchain *bc, TxPool *p) {
+    return index_build_from(idx, bc, p, 0);
+}
+
+int index_build_from(LedgerIndex *idx, Blockchain *bc, TxPool *p,
+                     int from) {
+    for (int i = from; i < bc->length; i++)
+        index_add_block(idx, i, blockchain_block(bc, i));
+    for (int i = 0; i < p->count; i++)
+        index_add_pool(idx, p->taken + (uint32_t)i, pool_tx(p, i));
+    bc->index = idx;
+    p->index  = idx;
+    return idx->valid;
+}
+
+//snapshots: the maps and entry arrays are written as they are, each
+//8-byte aligned, and read back in place: they are used straight from the
+//snapshot's map until they first grow. reading checks that every link
+//stays in range and only points forward, so a damaged file cannot send a
+//walk out of bounds or round in circles
+
+static int pad8(FILE *f) {
+    static const char zero[8];
+    long at = ftell(f);
+    return at >= 0 && fwrite(zero, 1, (size_t)(-at & 7), f) == (size_t)(-at & 7);
+}
+
+static int map_write(const IdMap *m, const void *entries, size_t stride,
+                     FILE *f) {
+    return fwrite(&m->cap, sizeof(m->cap), 1, f) == 1 &&
+           fwrite(&m->used, sizeof(m->used), 1, f) == 1 &&
+           fwrite(m->entry, sizeof(int32_t), m->cap, f) == m->cap &&
+           pad8(f) &&
+           fwrite(entries, stride, (size_t)m->used, f) == (size_t)m->used &&
+           pad8(f);
+}
+
+int index_write(const LedgerIndex *idx, FILE *f) {
+    return pad8(f) &&
+           map_write(&idx->invoice_map, idx->invoices,
+                     sizeof(InvoiceEntry), f) &&
+           map_write(&idx->student_map, idx->students,
+                     sizeof(StudentEntry), f) &&
+           fwrite(&idx->event_count, sizeof(idx->event_count), 1, f) == 1 &&
+           pad8(f) &&
+           fwrite(idx->events, sizeof(IndexEvent),
+                  (size_t)idx->event_count, f) == (size_t)idx->event_count;
+}
+
+//the next n bytes of the map from *at, which is then rounded up to 8
+static void *take(const LedgerIndex *idx, size_t *at, size_t n) {
+    if (*at > idx->map_len || n > idx->map_len - *at) return NULL;
+    void *p = (char *)idx->map + *at;
+    *at += (n + 7) & ~(size_t)7;
+    return p;
+}
+
+static int map_read(LedgerIndex *idx, IdMap *m, void **entries,
+                    size_t stride, size_t *at) {
+    const uint32_t *hdr = take(idx, at, 8);
+    if (!hdr) return 0;
+    m->cap  = hdr[0];
+    m->used = (int32_t)hdr[1];
+    if (m->cap < INDEX_MIN_CAP || (m->cap & (m->cap - 1)) || m->used < 0 ||
+        (uint32_t)m->used > m->cap ||
+        !(m->entry = take(idx, at, m->cap * sizeof(int32_t))) ||
+        !(*entries = take(idx, at, (size_t)m->used * stride)))
+        return 0;
+    //an empty array gets room of its own, growing it doubles entry_cap
+    m->entry_cap = m->used;
+    if (m->used == 0) {
+        m->entry_cap = INDEX_MIN_CAP;
+        if (!(*entries = malloc(INDEX_MIN_CAP * stride))) return 0;
+    }
+    for (uint32_t id = 0; id < m->cap; id++)
+        if (m->entry[id] < 0 || m->entry[id] > m->used) return 0;
+    return 1;
+}
+
+//n is -1 or an entry below count
+static int link_ok(int32_t n, int32_t count) {
+    return n >= -1 && n < count;
+}
+
+int index_read(LedgerIndex *idx, void *map, size_t len, size_t at,
+               int height) {
+    memset(idx, 0, sizeof(*idx));
+    idx->map     = map;
+    idx->map_len = len;
+    at           = (at + 7) & ~(size_t)7;
+    const int32_t *count;
+    int ok = map_read(idx, &idx->invoice_map, (void **)&idx->invoices,
+                      sizeof(InvoiceEntry), &at) &&
+             map_read(idx, &idx->student_map, (void **)&idx->students,
+                      sizeof(StudentEntry), &at) &&
+             (count = take(idx, &at, sizeof(int32_t))) && *count >= 0 &&
+             (idx->events = take(idx, &at,
+                                 (size_t)*count * sizeof(IndexEvent))) &&
+             at >= len;
+    if (ok) idx->event_count = idx->event_cap = *count;
+    if (ok && *count == 0) idx->events = NULL;
+
+    int32_t invoices = ok ? idx->invoice_map.used : 0;
+    int32_t students = ok ? idx->student_map.used : 0;
+    for (int32_t e = 0; ok && e < idx->event_count; e++) {
+        const IndexEvent *ev = &idx->events[e];
+        ok = ev->height >= 0 && ev->height < height &&
+             (ev->next == -1 || (ev->next > e && ev->next < idx->event_count));
+    }
+    for (int32_t n = 0; ok && n < invoices; n++) {
+        const InvoiceEntry *e = &idx->invoices[n];
+        ok = map_find(&idx->invoice_map, e->id) == n &&
+             e->head >= 0 && e->head <= e->tail &&
+             e->tail < idx->event_count && link_ok(e->student, students) &&
+             (e->next_invoice == -1 || e->next_invoice > n) &&
+             link_ok(e->next_invoice, invoices) && !e->has_pending;
+    }
+    for (int32_t n = 0; ok && n < students; n++) {
+        const StudentEntry *s = &idx->students[n];
+        ok = map_find(&idx->student_map, s->id) == n &&
+             s->first_invoice >= 0 && s->first_invoice <= s->last_invoice &&
+             s->last_invoice < invoices;
+    }
+    if (!ok) {
+        //the map stays the caller's
+        release(idx, idx->invoices);
+        release(idx, idx->students);
+        memset(idx, 0, sizeof(*idx));
+        return 0;
+    }
+    idx->valid      = 1;
+    idx->free_event = -1;
+    return 1;
+}
+
+//state table
+
+//e's row with the pending overlay applied while it is still in p
+static void resolve(const InvoiceEntry *e, const TxPool *p,
+                    InvoiceState *st) {
+    *st = e->chain;
+    if (!p || !e->has_pending ||
+        e->pending_seq - p->taken >= (uint32_t)p->count)
+        return;
+    if (e->pending.created) {
+        st->created = 1;
+        st->student = e->pending.student;
+        st->amount  = e->pending.amount;
+    }
+    st->balance = e->pending.balance;
+}
+
+int invoice_state(const Blockchain *bc, const TxPool *p, StrId invoice,
+                  InvoiceState *st) {
+    const LedgerIndex *idx = bc->index;
+    state_init(st);
+    if (idx && idx->valid) {
+        int32_t inv = map_find(&idx->invoice_map, invoice);
+        if (inv >= 0) resolve(&idx->invoices[inv], p, st);
+        STAT_ADD(STAT_LOOKUPS, 1);
+        return st->created;
+    }
+
+    EventCursor        c;
+    const Transaction *t;
+    int                height;
+    invoice_events_begin(&c, bc, p, invoice);
+    while ((t = invoice_events_next(&c, &height)) != NULL)
+        fold_event(st, t, height, (uint32_t)(c.slot - 1));
+    return st->created;
+}
+
+static int same_state(const InvoiceState *a, const InvoiceState *b) {
+    return a->created == b->created && a->settled == b->settled &&
+           a->student == b->student && a->amount == b->amount &&
+           a->balance == b->balance && a->last_height == b->last_height &&
+           (a->last_height < 0 || a->last_slot == b->last_slot);
+}
+
+int index_check(const LedgerIndex *idx, const Blockchain *bc,
+                const TxPool *p, StrId *first) {
+    LedgerIndex fresh;
+    int         bad = 0;
+
+    if (!index_init(&fresh)) {
+        index_free(&fresh);
+        return -1;
+    }
+    for (int i = 0; i < bc->length; i++)
+        index_add_block(&fresh, i, blockchain_block(bc, i));
+    for (int i = 0; i < p->count; i++)
+        index_add_pool(&fresh, p->taken + (uint32_t)i, pool_tx(p, i));
+    if (!fresh.valid) {
+        index_free(&fresh);
+        return -1;
+    }
+
+    *first = STR_NONE;
+    for (int32_t n = 0; n < fresh.invoice_map.used; n++) {
+        const InvoiceEntry *want = &fresh.invoices[n];
+        int32_t             inv  = map_find(&idx->invoice_map, want->id);
+        InvoiceState        a, b, c, d;
+        int                 ok = inv >= 0;
+        if (ok) {
+            resolve(want, NULL, &a);
+            resolve(&idx->invoices[inv], NULL, &b);
+            resolve(want, p, &c);
+            resolve(&idx->invoices[inv], p, &d);
+            ok = same_state(&a, &b) && same_state(&c, &d);
+        }
+        if (!ok && bad++ == 0) *first = want->id;
+    }
+    //invoices the table has and the chain does not
+    if (idx->invoice_map.used > fresh.invoice_map.used)
+        bad += idx->invoice_map.used - fresh.invoice_map.used;
+    index_free(&fresh);
+    return bad;
+}
+
+//cursor
+
+void invoice_events_begin(EventCursor *c, const Blockchain *bc,
+                          const TxPool *p, StrId invoice) {
+    memset(c, 0, sizeof(*c));
+    c->bc      = bc;
+    c->p       = p;
+    c->invoice = invoice;
+    c->event   = -1;
+    STAT_ADD(STAT_LOOKUPS, 1);
+    if (bc->index && bc->index->valid) {
+        int32_t inv = map_find(&bc->index->invoice_map, invoice);
+        c->idx   = bc->index;
+        c->head  = inv >= 0 ? bc->index->invoices[inv].head : -1;
+        c->event = c->head;
+    }
+}
+
+//events still pending can sit in front of the chain copy of an older
+//one, mined after they were queued, so the index is walked twice: chain
+//events, then live pool ones
+static const Transaction *next_indexed(EventCursor *c, int *height) {
+    int seen = 0;
+    while (c->pass < 2) {
+        while (c->event >= 0) {
+            const IndexEvent  *ev = &c->idx->events[c->event];
+            const Transaction *t  = NULL;
+            c->event = ev->next;
+            seen++;
+            if (c->pass == 0 && ev->height != INDEX_POOL) {
+                if (ev->height >= c->bc->length) continue;
+                const Block *blk = blockchain_block(c->bc, ev->height);
+                if ((int)ev->slot < blk->tx_count)
+                    t = &blk->transactions[ev->slot];
+            } else if (c->pass == 1 && ev->height == INDEX_POOL && c->p) {
+                uint32_t pos = ev->slot - c->p->taken;
+                if (pos < (uint32_t)c->p->count) t = pool_tx(c->p, (int)pos);
+            }
+            if (t && t->invoice == c->invoice) {
+                *height = ev->height;
+                STAT_ADD(STAT_SCANNED_TXS, seen);
+                return t;
+            }
+        }
+        if (++c->pass < 2) c->event = c->head;
+    }
+    STAT_ADD(STAT_SCANNED_TXS, seen);
+    return NULL;
+}
+
+//what was looked at is counted from the slot positions, a block at a
+//time rather than per transaction
+static const Transaction *next_scanned(EventCursor *c, int *height) {
+    int seen = -c->slot;
+    for (; c->height < c->bc->length; c->height++, c->slot = 0) {
+        const Block *blk = blockchain_block(c->bc, c->height);
+        while (c->slot < blk->tx_count) {
+            const Transaction *t = &blk->transactions[c->slot++];
+            if (t->invoice == c->invoice) {
+                *height = c->height;
+                STAT_ADD(STAT_SCANNED_TXS, seen + c->slot);
+                return t;
+            }
+        }
+        seen += c->slot;
+    }
+    while (c->p && c->slot < c->p->count) {
+        const Transaction *t = pool_tx(c->p, c->slot++);
+        if (t->invoice == c->invoice) {
+            *height = INDEX_POOL;
+            STAT_ADD(STAT_SCANNED_TXS, seen + c->slot);
+            return t;
+        }
+    }
+    STAT_ADD(STAT_SCANNED_TXS, seen + c->slot);
+    return NULL;
+}
+
+const Transaction *invoice_events_next(EventCursor *c, int *height) {
+    int h;
+    if (!height) height = &h;
+    if (c->invoice == STR_NONE) return NULL;
+    return c->idx ? next_indexed(c, height) : next_scanned(c, height);
+}
+
+//student cursor
+
+void student_invoices_begin(StudentCursor *c, const Blockchain *bc,
+                            const TxPool *p, StrId student) {
+    memset(c, 0, sizeof(*c));
+    c->bc      = bc;
+    c->p       = p;
+    c->student = student;
+    c->invoice = -1;
+    STAT_ADD(STAT_LOOKUPS, 1);
+    if (bc->index && bc->index->valid) {
+        int32_t st = map_find(&bc->index->student_map, student);
+        c->idx     = bc->index;
+        c->invoice = st >= 0 ? bc->index->students[st].first_invoice : -1;
+    }
+}
+
+static int creates_for(const Transaction *t, StrId student) {
+    return t->type == TX_INVOICE_CREATE && t->student == student;
+}
+
+StrId student_invoices_next(StudentCursor *c) {
+    if (c->student == STR_NONE) return STR_NONE;
+    if (c->idx) {
+        if (c->invoice < 0) return STR_NONE;
+        const InvoiceEntry *inv = &c->idx->invoices[c->invoice];
+        c->invoice = inv->next_invoice;
+        return inv->id;
+    }
+
+    int seen = -c->slot;
+    for (; c->height < c->bc->length; c->height++, c->slot = 0) {
+        const Block *blk = blockchain_block(c->bc, c->height);
+        while (c->slot < blk->tx_count) {
+            const Transaction *t = &blk->transactions[c->slot++];
+            if (creates_for(t, c->student)) {
+                STAT_ADD(STAT_SCANNED_TXS, seen + c->slot);
+                return t->invoice;
+            }
+        }
+        seen += c->slot;
+    }
+    while (c->p && c->slot < c->p->count) {
+        const Transaction *t = pool_tx(c->p, c->slot++);
+        if (creates_for(t, c->student)) {
+            STAT_ADD(STAT_SCANNED_TXS, seen + c->slot);
+            return t->invoice;
+        }
+    }
+    STAT_ADD(STAT_SCANNED_TXS, seen + c->slot);
+    return STR_NONE;
+}
@@ -0,0 +1,155 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdio.h>
+#include "blockchain.h"
+
+//in-memory indexes over the ledger:
+//  invoice -> the invoice's events, in the order they happened
+//  student -> the student's invoices, in the order they were created
+//an event is a chain position (height, slot) or a pending pool entry
+//named by its pool sequence number (TxPool.taken plus its position), so
+//pool entries never need renumbering. when an entry leaves the pool for
+//a block its event is unlinked and the slot reused; the chain copy has
+//an event of its own
+#define INDEX_POOL (-1)
+
+typedef struct {
+    int32_t  height;   /* block height, INDEX_POOL for the pending pool */
+    uint32_t slot;     /* tx slot in the block, or pool sequence number */
+    int32_t  next;     /* next event of the same invoice, -1 = last */
+} IndexEvent;
+
+//an invoice's state, folded from its events in order: the create sets
+//the amount and balance, payments and settlements set the balance.
+//settled and the last event only count mined events
+typedef struct {
+    int      created;
+    int      settled;
+    StrId    student;
+    int64_t  amount;
+    int64_t  balance;
+    int32_t  last_height;     /* last mined event, -1 = none */
+    uint32_t last_slot;
+} InvoiceState;
+
+//entries live in arrays that only grow, so entry numbers are stable.
+//ids are interned (strtab.h), so looking one up is a plain array read:
+//the map holds entry number + 1 for each handle, 0 for none
+typedef struct {
+    StrId    id;
+    int32_t  head;            /* events */
+    int32_t  tail;
+    int32_t  student;         /* student entry, -1 until the create is seen */
+    int32_t  next_invoice;    /* next invoice of the same student */
+    //materialized state: mined events are folded into chain as blocks
+    //are added; pending events are folded into their own row, which is
+    //laid over chain for as long as the newest of them (pending_seq) is
+    //still in the pool. once it is mined chain has caught up with it
+    InvoiceState chain;
+    InvoiceState pending;
+    uint32_t     pending_seq;
+    int          has_pending;
+} InvoiceEntry;
+
+typedef struct {
+    StrId    id;
+    int32_t  first_invoice;
+    int32_t  last_invoice;
+} StudentEntry;
+
+typedef struct {
+    int32_t  *entry;      /* by handle */
+    uint32_t  cap;        /* handles covered */
+    int32_t   used;       /* entries */
+    int32_t   entry_cap;
+} IdMap;
+
+typedef struct LedgerIndex {
+    IdMap         invoice_map;
+    InvoiceEntry *invoices;
+    IdMap         student_map;
+    StudentEntry *students;
+    IndexEvent   *events;
+    int32_t       event_count;
+    int32_t       event_cap;
+    int32_t       free_event;  /* dropped events to reuse, -1 = none */
+    int           valid;       /* 0 after a failed update: lookups scan */
+    void         *map;         /* snapshot the arrays were read from */
+    size_t        map_len;
+} LedgerIndex;
+
+int  index_init(LedgerIndex *idx);
+void index_free(LedgerIndex *idx);
+
+//index everything in bc and p, then attach the index to both so that
+//blockchain_push and pool_add keep it current
+int  index_build(LedgerIndex *idx, Blockchain *bc, TxPool *p);
+//the same for an index that already holds the blocks below from (read
+//back from a state snapshot): only the blocks from there on are added
+int  index_build_from(LedgerIndex *idx, Blockchain *bc, TxPool *p,
+                      int from);
+void index_add_block(LedgerIndex *idx, int height, const Block *b);
+void index_add_pool(LedgerIndex *idx, uint32_t seq, const Transaction *tx);
+//pool entry seq is leaving the pool (pool_discard)
+void index_drop_pool(LedgerIndex *idx, uint32_t seq, const Transaction *tx);
+
+//an index of mined blocks only, as raw arrays for a state snapshot.
+//index_read uses the arrays found at map+at in place (map is a private
+//writable mmap of the whole file, which idx owns from then on) and checks
+//every entry and link and that every event lies below height; 0, with
+//idx empty and the map still the caller's, if it is short or damaged
+int  index_write(const LedgerIndex *idx, FILE *f);
+int  index_read(LedgerIndex *idx, void *map, size_t len, size_t at,
+                int height);
+
+//an invoice's current state, with p's pending events on top (p may be
+//NULL for mined events only); returns st->created. reads one row of the
+//index when bc has a valid one and replays the events otherwise
+int  invoice_state(const Blockchain *bc, const TxPool *p, StrId invoice,
+                   InvoiceState *st);
+//consistency check: rebuilds the state table from bc and p and compares
+//it with idx's, with and without the pool. returns how many invoices
+//differ (the first in *first), -1 if out of memory
+int  index_check(const LedgerIndex *idx, const Blockchain *bc,
+                 const TxPool *p, StrId *first);
+
+//walk an invoice's events oldest first: chain events, then pending ones.
+//uses the index when bc has a valid one and scans everything otherwise;
+//p may be NULL to leave the pool out. ids are compared by handle, so
+//callers holding a string look it up once with str_find; an id that was
+//never interned has no events
+typedef struct {
+    const Blockchain  *bc;
+    const TxPool      *p;
+    const LedgerIndex *idx;
+    StrId              invoice;
+    int32_t            head;     /* first index event, -1 = none */
+    int32_t            event;    /* next index event */
+    int                pass;     /* index walk: 0 = chain, 1 = pool */
+    int                height;   /* scan position: block, then pool */
+    int                slot;
+} EventCursor;
+
+void invoice_events_begin(EventCursor *c, const Blockchain *bc,
+                          const TxPool *p, StrId invoice);
+//next event, or NULL when done; *height is INDEX_POOL for pool entries
+const Transaction *invoice_events_next(EventCursor *c, int *height);
+
+//walk a student's invoices in creation order, same rules as above
+typedef struct {
+    const Blockchain  *bc;
+    const TxPool      *p;
+    const LedgerIndex *idx;
+    StrId              student;
+    int32_t            invoice;  /* next index entry, -1 = none */
+    int                height;   /* scan position: block, then pool */
+    int                slot;
+} StudentCursor;
+
+void student_invoices_begin(StudentCursor *c, const Blockchain *bc,
+                            const TxPool *p, StrId student);
+//next invoice, or STR_NONE when done
+StrId student_invoices_next(StudentCursor *c);
+
+#endif
@@ -0,0 +1,408 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "ingest.h"
+#include "index.h"
+#include "miner.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define INGEST_LINE  1024
+#define FIELD_MAX    128   /* longer than any id or reference we accept */
+#define INGEST_BATCH 1024  /* records per pool log write */
+
+typedef struct {
+    char type[FIELD_MAX];
+    char student_id[FIELD_MAX];
+    char invoice_id[FIELD_MAX];
+    char amount[FIELD_MAX];
+    char reference[FIELD_MAX];
+} Record;
+
+typedef struct {
+    Blockchain  *bc;
+    TxPool      *p;
+    ChainLog    *chain_log;
+    PoolLog     *pool_log;
+    MinerConfig  miner;
+    int          unlogged;   /* transactions at the pool tail not yet logged */
+    IngestStats *st;
+} Ingest;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+//parsing: each returns NULL on success or a message for the bad line
+
+static char *csv_column(Record *r, int col) {
+    switch (col) {
+    case 0: return r->type;
+    case 1: return r->student_id;
+    case 2: return r->invoice_id;
+    case 3: return r->amount;
+    case 4: return r->reference;
+    }
+    return NULL;
+}
+
+static char *json_field(Record *r, const char *key) {
+    if (strcmp(key, "type") == 0)       return r->type;
+    if (strcmp(key, "student_id") == 0) return r->student_id;
+    if (strcmp(key, "invoice_id") == 0) return r->invoice_id;
+    if (strcmp(key, "amount") == 0)     return r->amount;
+    if (strcmp(key, "reference") == 0)  return r->reference;
+    return NULL;   /* unknown keys are ignored */
+}
+
+//fields may be double-quoted, with "" standing for a quote
+static const char *parse_csv(const char *s, Record *r) {
+    for (int col = 0; ; col++) {
+        char   buf[FIELD_MAX];
+        size_t n      = 0;
+        int    quoted = 0;
+
+        while (*s == ' ' || *s == '\t') s++;
+        if (*s == '"') {
+            quoted = 1;
+            s++;
+        }
+        while (*s) {
+            if (quoted) {
+                if (*s == '"' && s[1] != '"') {
+                    s++;
+                    quoted = 2;
+                    break;
+                }
+                if (*s == '"') s++;
+            } else if (*s == ',') {
+                break;
+            }
+            if (n + 1 >= FIELD_MAX) return "field too long";
+            buf[n++] = *s++;
+        }
+        if (quoted == 1) return "unterminated quote";
+        if (quoted == 2) {
+            while (*s == ' ' || *s == '\t') s++;
+            if (*s && *s != ',') return "text after a closing quote";
+        } else {
+            while (n > 0 && isspace((unsigned char)buf[n - 1])) n--;
+        }
+        buf[n] = '\0';
+
+        char *dst = csv_column(r, col);
+        if (!dst) return "too many columns";
+        memcpy(dst, buf, n + 1);
+        if (*s != ',') return col < 3 ? "expected at least 4 columns" : NULL;
+        s++;
+    }
+}
+
+static const char *skip_ws(const char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    return s;
+}
+
+static int hex_digit(char c) {
+    return c >= 'a' ? c - 'a' + 10 : c >= 'A' ? c - 'A' + 10 : c - '0';
+}
+
+//*sp points at the opening quote; left just past the closing one
+static const char *json_string(const char **sp, char out[FIELD_MAX]) {
+    const char *s = *sp + 1;
+    char        enc[3];
+    size_t      n = 0;
+
+    for (;;) {
+        int k = 1;
+        enc[0] = *s++;
+        if (enc[0] == '\0') return "unterminated string";
+        if (enc[0] == '"') break;
+        if (enc[0] == '\\') {
+            switch (enc[0] = *s++) {
+            case '"': case '\\': case '/': break;
+            case 'b': enc[0] = '\b'; break;
+            case 'f': enc[0] = '\f'; break;
+            case 'n': enc[0] = '\n'; break;
+            case 'r': enc[0] = '\r'; break;
+            case 't': enc[0] = '\t'; break;
+            case 'u': {
+                unsigned v = 0;
+                for (int i = 0; i < 4; i++) {
+                    if (!isxdigit((unsigned char)s[i]))
+                        return "bad \\u escape";
+                    v = v * 16 + (unsigned)hex_digit(s[i]);
+                }
+                s += 4;
+                if (v >= 0xD800 && v < 0xE000)
+                    return "unsupported \\u escape";
+                //utf-8
+                if (v < 0x80) {
+                    enc[0] = (char)v;
+                } else if (v < 0x800) {
+                    enc[0] = (char)(0xC0 | v >> 6);
+                    enc[1] = (char)(0x80 | (v & 0x3F));
+                    k = 2;
+                } else {
+                    enc[0] = (char)(0xE0 | v >> 12);
+                    enc[1] = (char)(0x80 | ((v >> 6) & 0x3F));
+                    enc[2] = (char)(0x80 | (v & 0x3F));
+                    k = 3;
+                }
+                break;
+            }
+            default:
+                return "bad escape";
+            }
+        }
+        if (n + (size_t)k >= FIELD_MAX) return "field too long";
+        memcpy(out + n, enc, (size_t)k);
+        n += (size_t)k;
+    }
+    out[n] = '\0';
+    *sp    = s;
+    return NULL;
+}
+
+//a flat object of string, number, true/false or null values
+static const char *parse_json(const char *s, Record *r) {
+    const char *err;
+
+    s = skip_ws(s + 1);
+    if (*s == '}') return *skip_ws(s + 1) ? "text after the object" : NULL;
+    for (;;) {
+        char key[FIELD_MAX], val[FIELD_MAX];
+
+        if (*s != '"') return "expected a key";
+        if ((err = json_string(&s, key)) != NULL) return err;
+        s = skip_ws(s);
+        if (*s++ != ':') return "expected ':'";
+        s = skip_ws(s);
+        if (*s == '"') {
+            if ((err = json_string(&s, val)) != NULL) return err;
+        } else if (*s == '{' || *s == '[') {
+            return "nested values are not supported";
+        } else {
+            size_t n = 0;
+            while (*s && *s != ',' && *s != '}' &&
+                   !isspace((unsigned char)*s)) {
+                if (n + 1 >= FIELD_MAX) return "field too long";
+                val[n++] = *s++;
+            }
+            val[n] = '\0';
+            if (n == 0) return "expected a value";
+            if (strcmp(val, "null") == 0) val[0] = '\0';
+        }
+
+        char *dst = json_field(r, key);
+        if (dst) memcpy(dst, val, strlen(val) + 1);
+
+        s = skip_ws(s);
+        if (*s == ',') {
+            s = skip_ws(s + 1);
+            continue;
+        }
+        if (*s != '}') return "expected ',' or '}'";
+        return *skip_ws(s + 1) ? "text after the object" : NULL;
+    }
+}
+
+//building transactions
+
+static const char *read_amount(const char *s, int64_t *amount) {
+    char   buf[FIELD_MAX];
+    size_t n;
+    s = skip_ws(s);
+    n = strlen(s);
+    while (n > 0 && isspace((unsigned char)s[n - 1])) n--;
+    if (n == 0) return "missing amount";
+    snprintf(buf, sizeof(buf), "%.*s", (int)n, s);
+    if (buf[0] == '-') return "amount must be positive";
+    if (!parse_amount(buf, amount))
+        return "amount is not a number with at most 2 decimals";
+    if (!validate_amount(*amount)) return "amount must be positive";
+    return NULL;
+}
+
+static const char *make_invoice(const Ingest *in, const Record *r,
+                                Transaction *tx) {
+    const char *err;
+    int64_t     amount;
+
+    if (!validate_student_id(r->student_id)) return "invalid student_id";
+    if (!validate_invoice_id(r->invoice_id)) return "invalid invoice_id";
+    if ((err = read_amount(r->amount, &amount)) != NULL) return err;
+    if (strlen(r->reference) >= MAX_REF) return "reference too long";
+    if (invoice_exists(in->bc, in->p, r->invoice_id))
+        return "invoice_id already exists";
+
+    tx->type      = TX_INVOICE_CREATE;
+    tx->amount    = amount;
+    tx->balance   = amount;
+    tx->confirmed = 1;
+    tx->student   = str_intern(r->student_id);
+    tx->invoice   = str_intern(r->invoice_id);
+    tx->reference = str_intern(r->reference[0] ? r->reference
+                                               : "ALU Tuition Invoice");
+    return NULL;
+}
+
+//the invoice's row in the state table gives its student, balance and
+//whether it was settled
+static const char *make_payment(const Ingest *in, const Record *r,
+                                Transaction *tx) {
+    const char  *err;
+    int64_t      amount;
+    StrId        invoice = str_find(r->invoice_id);
+    InvoiceState st;
+
+    if (!validate_invoice_id(r->invoice_id)) return "invalid invoice_id";
+    if (r->student_id[0] && !validate_student_id(r->student_id))
+        return "invalid student_id";
+    if ((err = read_amount(r->amount, &amount)) != NULL) return err;
+    if (strlen(r->reference) >= MAX_REF) return "reference too long";
+
+    if (!invoice_state(in->bc, in->p, invoice, &st))
+        return "invoice not found";
+    if (st.settled) return "invoice is already fully settled";
+    if (r->student_id[0] && str_find(r->student_id) != st.student)
+        return "student_id does not match the invoice";
+    if (amount > st.balance) return "payment exceeds the balance";
+
+    tx->type      = TX_PAYMENT_MADE;
+    tx->amount    = amount;
+    tx->balance   = st.balance - amount;
+    tx->confirmed = 0;   //confirmed later, as from the menu
+    tx->student   = st.student;
+    tx->invoice   = invoice;
+    tx->reference = str_intern(r->reference[0] ? r->reference : "PAYMENT");
+    return NULL;
+}
+
+//batches
+
+//log everything queued since the last batch with a single write
+static int persist(Ingest *in) {
+    if (in->unlogged == 0) return 1;
+    if (!poollog_add_batch(in->pool_log, in->p, in->p->count - in->unlogged,
+                           in->unlogged))
+        return 0;
+    in->unlogged = 0;
+    return 1;
+}
+
+//mine while at least `min` transactions are pending; the pool has to be
+//fully logged first so that the TAKE records line up
+static int mine_pending(Ingest *in, int min) {
+    Block *b  = block_new(in->bc->block_txs);
+    int    ok = b && persist(in);
+    while (ok && in->p->count >= min && in->p->count > 0) {
+        ok = pool_flush_to_block(in->p, b, in->bc) &&
+             mine_block_parallel(b, (int)b->target_bits, &in->miner, NULL) &&
+             blockchain_add_mined_block(in->bc, b) &&
+             chainlog_append(in->chain_log, b);
+        if (!ok) break;
+        in->st->blocks++;
+        if (!poollog_take(in->pool_log, in->p, b)) {
+            //the block is in the chain log but the pool log does not say
+            //its transactions were taken; stop before it falls further behind
+            fprintf(stderr, "Error: block %u could not be recorded in the "
+                            "pending-pool log.\n", b->block_id);
+            ok = 0;
+        }
+    }
+    free(b);
+    return ok;
+}
+
+//returns 0 if the chain or logs could not be updated; a rejected record
+//is not an error, it only sets *err
+static int ingest_line(Ingest *in, const char *line, const char **err) {
+    Record      r;
+    Transaction tx;
+
+    memset(&r, 0, sizeof(r));
+    *err = *line == '{' ? parse_json(line, &r) : parse_csv(line, &r);
+    if (*err) return 1;
+
+    memset(&tx, 0, sizeof(tx));
+    if (strcmp(r.type, "invoice") == 0)
+        *err = make_invoice(in, &r, &tx);
+    else if (strcmp(r.type, "payment") == 0)
+        *err = make_payment(in, &r, &tx);
+    else
+        *err = "type must be \"invoice\" or \"payment\"";
+    if (*err) return 1;
+
+    //a batch ends when the pool is full or big enough; with no pool limit
+    //the batch size alone decides. only whole blocks are mined mid-stream,
+    //unless the pool cannot hold one: then a full pool is flushed, short
+    //block and all, or it would never empty
+    if (pool_full(in->p) || in->unlogged >= INGEST_BATCH) {
+        int min = pool_full(in->p) && in->p->limit < in->bc->block_txs
+                  ? 1 : in->bc->block_txs;
+        if (!mine_pending(in, min)) return 0;
+    }
+    tx.event_time = time(NULL);
+    if (!pool_add(in->p, &tx)) return 0;
+    in->unlogged++;
+    if (tx.type == TX_INVOICE_CREATE) in->st->invoices++;
+    else                              in->st->payments++;
+    return 1;
+}
+
+int ingest_stream(FILE *in_file, const char *name, Blockchain *bc,
+                  TxPool *p, ChainLog *chain_log, PoolLog *pool_log,
+                  IngestStats *st) {
+    Ingest in;
+    char   line[INGEST_LINE];
+    double start = now_seconds();
+    int    ok    = 1;
+
+    memset(st, 0, sizeof(*st));
+    memset(&in, 0, sizeof(in));
+    in.bc        = bc;
+    in.p         = p;
+    in.chain_log = chain_log;
+    in.pool_log  = pool_log;
+    in.miner     = *miner_get_config();
+    in.st        = st;
+    in.miner.quiet  = 1;
+    in.miner.report = 0;
+
+    while (ok && fgets(line, sizeof(line), in_file)) {
+        size_t len = strlen(line);
+        st->lines++;
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+            int c;
+            while ((c = fgetc(in_file)) != EOF && c != '\n')
+                ;
+            fprintf(stderr, "%s:%d: line too long\n", name, st->lines);
+            st->rejected++;
+            continue;
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+
+        const char *s = skip_ws(line);
+        if (*s == '\0' || *s == '#') continue;
+        if (st->lines == 1 && strncmp(s, "type,", 5) == 0) continue;
+
+        const char *err;
+        ok = ingest_line(&in, s, &err);
+        if (ok && err) {
+            fprintf(stderr, "%s:%d: %s\n", name, st->lines, err);
+            st->rejected++;
+        }
+    }
+    if (ok && ferror(in_file)) {
+        perror(name);
+        ok = 0;
+    }
+    if (ok && !mine_pending(&in, 1)) ok = 0;
+
+    st->seconds = now_seconds() - start;
+    return ok;
+}
@@ -0,0 +1,33 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stdio.h>
+#include "blockchain.h"
+#include "chainlog.h"
+
+//non-interactive bulk loading. one record per line, CSV or JSONL:
+//  invoice,STU001,INV001,150000,Term 1 tuition
+//  {"type":"payment","invoice_id":"INV001","amount":50000,"reference":"BK-1"}
+//CSV columns are type,student_id,invoice_id,amount[,reference]; JSON keys
+//have the same names. type is "invoice" or "payment"; a payment may leave
+//student_id empty, it is taken from the invoice. blank lines, '#'
+//comments and a CSV header line are skipped
+typedef struct {
+    int    lines;
+    int    invoices;
+    int    payments;
+    int    rejected;
+    int    blocks;      /* blocks mined */
+    double seconds;
+} IngestStats;
+
+//validate each record as the menu would and queue it in the pool;
+//whenever the pool reaches its limit or a batch of records has built up,
+//the new transactions go to the pool log in one write and full blocks
+//are mined and appended to the chain log. whatever is left is mined at
+//the end. bad lines are reported on stderr and skipped. returns 0 if the
+//chain or logs could not be updated
+int ingest_stream(FILE *in, const char *name, Blockchain *bc, TxPool *p,
+                  ChainLog *chain_log, PoolLog *pool_log, IngestStats *st);
+
+#endif
@@ -0,0 +1,152 @@
+#include "merkle.h"
+#include "sha256.h"
+#include <string.h>
+
+#define NODE_LEN 65   /* 0x01 | left | right */
+
+void merkle_leaf(const Transaction *tx, uint8_t out[32]) {
+    uint8_t    buf[1 + TX_SER_LEN];
+    SHA256_CTX ctx;
+    buf[0] = 0x00;
+    sha256_init(&ctx);
+    sha256_update(&ctx, buf, 1 + tx_serialize(tx, buf + 1));
+    sha256_final(&ctx, out);
+}
+
+static void node_hash(const uint8_t *left, const uint8_t *right,
+                      uint8_t out[32]) {
+    uint8_t    buf[NODE_LEN];
+    SHA256_CTX ctx;
+    buf[0] = 0x01;
+    memcpy(buf + 1, left, 32);
+    memcpy(buf + 33, right, 32);
+    sha256_init(&ctx);
+    sha256_update(&ctx, buf, NODE_LEN);
+    sha256_final(&ctx, out);
+}
+
+//leaves and each level's pairs are hashed SHA256_LANES at a time with the
+//multi-buffer kernel
+static void hash_leaves(const Transaction *txs, int n, uint8_t out[][32]) {
+    uint8_t        bufs[SHA256_LANES][1 + TX_SER_LEN];
+    const uint8_t *msgs[SHA256_LANES];
+    size_t         lens[SHA256_LANES];
+
+    for (int base = 0; base < n; base += SHA256_LANES) {
+        int k = n - base < SHA256_LANES ? n - base : SHA256_LANES;
+        for (int i = 0; i < k; i++) {
+            bufs[i][0] = 0x00;
+            lens[i]    = 1 + tx_serialize(&txs[base + i], bufs[i] + 1);
+            msgs[i]    = bufs[i];
+        }
+        sha256_x8(msgs, lens, k, out + base);
+    }
+}
+
+//replace level[0..n) with the level above it; returns its size
+static int next_level(uint8_t level[][32], int n) {
+    uint8_t        bufs[SHA256_LANES][NODE_LEN];
+    const uint8_t *msgs[SHA256_LANES];
+    size_t         lens[SHA256_LANES];
+    int            pairs = n / 2;
+
+    for (int base = 0; base < pairs; base += SHA256_LANES) {
+        int k = pairs - base < SHA256_LANES ? pairs - base : SHA256_LANES;
+        for (int i = 0; i < k; i++) {
+            bufs[i][0] = 0x01;
+            memcpy(bufs[i] + 1,  level[2 * (base + i)],     32);
+            memcpy(bufs[i] + 33, level[2 * (base + i) + 1], 32);
+            lens[i] = NODE_LEN;
+            msgs[i] = bufs[i];
+        }
+        sha256_x8(msgs, lens, k, level + base);
+    }
+    if (n & 1) memmove(level[pairs], level[n - 1], 32);
+    return pairs + (n & 1);
+}
+
+void merkle_root(const Transaction *txs, int n, uint8_t root[32]) {
+    if (n <= 0) {
+        memset(root, 0, 32);
+        return;
+    }
+    uint8_t level[n][32];
+    hash_leaves(txs, n, level);
+    while (n > 1) n = next_level(level, n);
+    memcpy(root, level[0], 32);
+}
+
+//returns 0 if index is out of range
+int merkle_prove(const Transaction *txs, int n, int index,
+                 MerkleProof *proof) {
+    if (index < 0 || index >= n) return 0;
+    memset(proof, 0, sizeof(*proof));
+    proof->index      = (uint32_t)index;
+    proof->leaf_count = (uint32_t)n;
+
+    uint8_t level[n][32];
+    hash_leaves(txs, n, level);
+    for (int pos = index; n > 1; pos >>= 1) {
+        if ((pos ^ 1) < n) {
+            if (proof->depth == MERKLE_MAX_DEPTH) return 0;
+            memcpy(proof->siblings[proof->depth++], level[pos ^ 1], 32);
+        }
+        n = next_level(level, n);
+    }
+    return 1;
+}
+
+//walk from the leaf to the root, pairing with a sibling only on levels
+//where the path has one
+int merkle_verify(const uint8_t leaf[32], const MerkleProof *proof,
+                  const uint8_t root[32]) {
+    uint8_t  h[32];
+    uint32_t pos = proof->index;
+    uint32_t n   = proof->leaf_count;
+    uint32_t k   = 0;
+
+    if (pos >= n) return 0;
+    memcpy(h, leaf, 32);
+    for (; n > 1; pos >>= 1, n = (n + 1) / 2) {
+        if ((pos ^ 1) >= n) continue;
+        if (k >= proof->depth) return 0;
+        if (pos & 1) node_hash(proof->siblings[k], h, h);
+        else         node_hash(h, proof->siblings[k], h);
+        k++;
+    }
+    return k == proof->depth && memcmp(h, root, 32) == 0;
+}
+
+//block proofs
+
+static void hex_to_bytes(const char *hex, uint8_t out[32]) {
+    for (int i = 0; i < 32; i++) {
+        unsigned v = 0;
+        for (int j = 0; j < 2; j++) {
+            char c = hex[i * 2 + j];
+            v = v * 16 + (unsigned)(c >= 'a' ? c - 'a' + 10 :
+                                    c >= 'A' ? c - 'A' + 10 : c - '0');
+        }
+        out[i] = (uint8_t)v;
+    }
+}
+
+int block_prove_tx(const Block *b, int slot, MerkleProof *proof) {
+    return merkle_prove(b->transactions, b->tx_count, slot, proof);
+}
+
+int block_verify_tx(const Block *header, const Transaction *tx,
+                    const MerkleProof *proof) {
+    Block   h = *header;
+    char    computed[HASH_HEX_LEN];
+    uint8_t leaf[32], root[32];
+
+    compute_block_hash(&h, computed);
+    if (strcmp(computed, header->hash) != 0) return 0;
+    if (!hex_meets_target(header->hash, (int)header->target_bits)) return 0;
+    if (proof->leaf_count != (uint32_t)header->tx_count) return 0;
+
+    merkle_leaf(tx, leaf);
+    hex_to_bytes(header->merkle_root, root);
+    return merkle_verify(leaf, proof, root);
+}
@@ -0,0 +1,39 @@
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include <stdint.h>
+#include "blockchain.h"
+
+//merkle tree over a block's transactions (RFC 6962 style):
+//  leaf = sha256(0x00 | serialised tx)
+//  node = sha256(0x01 | left | right)
+//a node without a sibling moves up a level unchanged; no transactions
+//give an all-zero root
+#define MERKLE_MAX_DEPTH 32
+
+//sibling hashes from the leaf up to the root; levels where the path had
+//no sibling are skipped, which index and leaf_count tell apart
+typedef struct {
+    uint32_t index;
+    uint32_t leaf_count;
+    uint32_t depth;
+    uint8_t  siblings[MERKLE_MAX_DEPTH][32];
+} MerkleProof;
+
+void merkle_leaf(const Transaction *tx, uint8_t out[32]);
+void merkle_root(const Transaction *txs, int n, uint8_t root[32]);
+int  merkle_prove(const Transaction *txs, int n, int index,
+                  MerkleProof *proof);
+int  merkle_verify(const uint8_t leaf[32], const MerkleProof *proof,
+                   const uint8_t root[32]);
+
+//inclusion proofs for a mined block: prove builds the proof for the
+//transaction in `slot`; verify needs only the block header (the
+//transactions are not read) and checks that the header hashes to its
+//stored hash, meets its target and that the proof links tx to its
+//merkle root
+int  block_prove_tx(const Block *b, int slot, MerkleProof *proof);
+int  block_verify_tx(const Block *header, const Transaction *tx,
+                     const MerkleProof *proof);
+
+#endif
@@ -0,0 +1,293 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "miner.h"
+#include "sha256.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+static MinerConfig g_config = { 0, 0, 1, 0, NULL, NULL };
+
+void miner_config_default(MinerConfig *cfg) {
+    cfg->threads       = 0;
+    cfg->deterministic = 0;
+    cfg->report        = 1;
+    cfg->quiet         = 0;
+    cfg->cancel        = NULL;
+    cfg->hashes        = NULL;
+}
+
+void miner_set_config(const MinerConfig *cfg) {
+    g_config = *cfg;
+}
+
+const MinerConfig *miner_get_config(void) {
+    return &g_config;
+}
+
+int miner_thread_count(const MinerConfig *cfg) {
+    int n = cfg ? cfg->threads : 0;
+    if (n <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        n = cores > 0 ? (int)cores : 1;
+    }
+    if (n > MINER_MAX_THREADS) n = MINER_MAX_THREADS;
+    return n;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+//state shared by all workers of one search
+typedef struct {
+    uint8_t     buf[BLOCK_HEADER_LEN];  /* serialised header, nonce zeroed */
+    size_t      len;
+    size_t      mid_len;             /* bytes absorbed into the midstate */
+    SHA256_CTX  mid;
+    int         bits;                /* required leading zero bits */
+    int         stride;
+    int         deterministic;
+    int         quiet;
+    const int  *cancel;
+    uint64_t   *progress;            /* shared hash counter, or NULL */
+    uint64_t    best;                /* lowest winning nonce, UINT64_MAX if none */
+    int         stop;
+} MineJob;
+
+typedef struct {
+    MineJob          *job;
+    int               index;
+    MinerThreadStats  stats;
+} MineWorker;
+
+//how often a worker adds to the shared progress counter
+#define PROGRESS_EVERY 4096
+
+static void put_nonce(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+//worker i tries nonces i, i+stride, i+2*stride, ... in groups of
+//SHA256_LANES that are hashed together by the multi-buffer kernel
+static void *mine_worker(void *arg) {
+    MineWorker    *w   = arg;
+    MineJob       *job = w->job;
+    uint8_t        tails[SHA256_LANES][128];
+    const uint8_t *tail_ptrs[SHA256_LANES];
+    size_t         tail_len = job->len - job->mid_len;
+    uint8_t        digests[SHA256_LANES][32];
+    uint64_t       stride = (uint64_t)job->stride;
+    uint64_t       hashes = 0;
+    uint64_t       counted = 0;      /* hashes already added to progress */
+    uint64_t       dot_every = 100000 / stride + 1;
+    uint64_t       next_dot  = dot_every;
+    double         start = now_seconds();
+
+    for (int l = 0; l < SHA256_LANES; l++) {
+        memcpy(tails[l], job->buf + job->mid_len, tail_len);
+        tail_ptrs[l] = tails[l];
+    }
+
+    for (uint64_t n = (uint64_t)w->index; ; n += stride * SHA256_LANES) {
+        if (__atomic_load_n(&job->stop, __ATOMIC_RELAXED)) break;
+        if (job->cancel && __atomic_load_n(job->cancel, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&job->stop, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        //nothing below the current best can be found past this point
+        if (n > __atomic_load_n(&job->best, __ATOMIC_RELAXED)) break;
+
+        for (int l = 0; l < SHA256_LANES; l++)
+            put_nonce(tails[l] + tail_len - 8, n + (uint64_t)l * stride);
+        sha256_x8_midstate(&job->mid, tail_ptrs, tail_len, SHA256_LANES,
+                           digests);
+        hashes += SHA256_LANES;
+
+        int found = -1;
+        for (int l = 0; l < SHA256_LANES && found < 0; l++)
+            if (hash_meets_target(digests[l], job->bits)) found = l;
+        if (found >= 0) {
+            uint64_t win = n + (uint64_t)found * stride;
+            uint64_t cur = __atomic_load_n(&job->best, __ATOMIC_RELAXED);
+            while (win < cur &&
+                   !__atomic_compare_exchange_n(&job->best, &cur, win, 0,
+                                                __ATOMIC_RELAXED,
+                                                __ATOMIC_RELAXED))
+                ;
+            if (!job->deterministic)
+                __atomic_store_n(&job->stop, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        if (job->progress && hashes - counted >= PROGRESS_EVERY) {
+            __atomic_add_fetch(job->progress, hashes - counted,
+                               __ATOMIC_RELAXED);
+            counted = hashes;
+        }
+        if (w->index == 0 && !job->quiet && hashes >= next_dot) {
+            next_dot += dot_every;
+            printf(".");
+            fflush(stdout);
+        }
+    }
+
+    if (job->progress)
+        __atomic_add_fetch(job->progress, hashes - counted, __ATOMIC_RELAXED);
+    w->stats.hashes  = hashes;
+    w->stats.seconds = now_seconds() - start;
+    return NULL;
+}
+
+//difficulty is the number of leading zero bits the hash needs; it is
+//stored in the block header before the search starts
+int mine_block_parallel(Block *b, int difficulty, const MinerConfig *cfg,
+                        MinerThreadStats *stats) {
+    MineJob    job;
+    MineWorker workers[MINER_MAX_THREADS];
+    pthread_t  tids[MINER_MAX_THREADS];
+    int        threads = miner_thread_count(cfg);
+
+    if (difficulty < MIN_TARGET_BITS || difficulty > MAX_TARGET_BITS)
+        difficulty = 8;
+
+    b->nonce       = 0;
+    b->target_bits = (uint32_t)difficulty;
+    int quiet      = cfg ? cfg->quiet : 0;
+    if (!quiet) {
+        printf("Mining block %u (difficulty=%d bits, threads=%d, sha256=%s) ",
+               b->block_id, difficulty, threads, sha256_x8_impl());
+        fflush(stdout);
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.len           = block_serialize(b, job.buf);
+    job.mid_len       = (job.len - 8) & ~(size_t)63;
+    job.bits          = difficulty;
+    job.stride        = threads;
+    job.deterministic = cfg ? cfg->deterministic : 0;
+    job.quiet         = quiet;
+    job.cancel        = cfg ? cfg->cancel : NULL;
+    job.progress      = cfg ? cfg->hashes : NULL;
+    job.best          = UINT64_MAX;
+    sha256_init(&job.mid);
+    sha256_update(&job.mid, job.buf, job.mid_len);
+
+    for (int i = 0; i < threads; i++) {
+        workers[i].job   = &job;
+        workers[i].index = i;
+        memset(&workers[i].stats, 0, sizeof(workers[i].stats));
+    }
+
+    //the calling thread works as worker 0
+    STAT_TIME_START(search);
+    int started = 1;
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&tids[i], NULL, mine_worker, &workers[i]) != 0)
+            break;
+        started++;
+    }
+    if (started < threads) {
+        //could not spawn every worker; restart with the ones we have
+        __atomic_store_n(&job.stop, 1, __ATOMIC_RELAXED);
+        for (int i = 1; i < started; i++) pthread_join(tids[i], NULL);
+        fprintf(stderr, "Warning: only %d mining thread(s) available.\n",
+                started);
+        MinerConfig fallback = cfg ? *cfg : g_config;
+        fallback.threads = started;
+        return mine_block_parallel(b, difficulty, &fallback, stats);
+    }
+    mine_worker(&workers[0]);
+    for (int i = 1; i < threads; i++) pthread_join(tids[i], NULL);
+
+    if (stats)
+        for (int i = 0; i < threads; i++) stats[i] = workers[i].stats;
+#if ALU_STATS
+    uint64_t tried = 0;
+    for (int i = 0; i < threads; i++) tried += workers[i].stats.hashes;
+    STAT_ADD(STAT_HASHES, tried);
+    STAT_ADD(STAT_MINE_NS, stat_now_ns() - search);
+    STAT_ADD(STAT_BLOCKS_MINED, job.best != UINT64_MAX);
+    STAT_TIME_STOP(TIMER_MINE, search);
+#endif
+
+    if (job.best == UINT64_MAX) {
+        if (!quiet) printf(" cancelled.\n");
+        return 0;
+    }
+
+    b->nonce = job.best;
+    compute_block_hash(b, b->hash);
+    if (quiet) return 1;
+    printf(" done!\n");
+    printf("  Hash: %s  Nonce: %llu\n",
+           b->hash, (unsigned long long)b->nonce);
+
+    if (cfg && cfg->report) {
+        uint64_t total = 0;
+        double   rate  = 0;
+        for (int i = 0; i < threads; i++) {
+            const MinerThreadStats *s = &workers[i].stats;
+            double r = s->seconds > 0 ? (double)s->hashes / s->seconds : 0;
+            total += s->hashes;
+            rate  += r;
+            if (threads > 1)
+                printf("  Thread %-2d : %10llu hashes  %12.0f H/s\n", i,
+                       (unsigned long long)s->hashes, r);
+        }
+        printf("  Total     : %10llu hashes  %12.0f H/s\n",
+               (unsigned long long)total, rate);
+    }
+    return 1;
+}
+
+int mine_block(Block *b, int difficulty) {
+    return mine_block_parallel(b, difficulty, &g_config, NULL);
+}
+
+int mine_reseal_chain(Blockchain *bc) {
+    Blockchain  out;
+    MinerConfig cfg    = g_config;
+    int         mined  = 0;
+    Block      *b      = block_new(bc->block_txs);
+
+    memset(&out, 0, sizeof(out));
+    out.block_txs         = bc->block_txs;
+    out.difficulty        = bc->difficulty;
+    out.target_block_time = bc->target_block_time;
+    out.retarget_window   = bc->retarget_window;
+    cfg.quiet  = 1;
+    cfg.cancel = NULL;
+    cfg.hashes = NULL;
+
+    for (int i = 0; b && i < bc->length; i++) {
+        const Block *old = blockchain_block(bc, i);
+        memcpy(b, old, BLOCK_BYTES(old->tx_count));
+        if (i > 0)
+            memcpy(b->prev_hash, blockchain_tip(&out)->hash, HASH_HEX_LEN);
+        block_set_merkle_root(b);
+
+        //blocks without amounts (the genesis) can keep their nonce
+        char hash[HASH_HEX_LEN];
+        compute_block_hash(b, hash);
+        if (strcmp(hash, old->hash) != 0) {
+            mine_block_parallel(b, (int)b->target_bits, &cfg, NULL);
+            mined++;
+        }
+        if (!blockchain_push(&out, b)) break;
+    }
+    free(b);
+    if (out.length != bc->length) {
+        blockchain_free(&out);
+        return -1;
+    }
+    out.index = bc->index;
+    blockchain_free(bc);
+    *bc = out;
+    return mined;
+}
@@ -0,0 +1,42 @@
+#ifndef MINER_H
+#define MINER_H
+
+#include <stdint.h>
+#include "blockchain.h"
+
+#define MINER_MAX_THREADS 64
+
+//mining options
+typedef struct {
+    int        threads;        /* worker count, 0 = one per online core */
+    int        deterministic;  /* always return the lowest winning nonce */
+    int        report;         /* print per-thread hash rates when done */
+    int        quiet;          /* no progress or result output at all */
+    const int *cancel;         /* optional flag, non-zero stops the search */
+    uint64_t  *hashes;         /* optional counter of hashes tried so far */
+} MinerConfig;
+
+//per-worker result
+typedef struct {
+    uint64_t hashes;
+    double   seconds;
+} MinerThreadStats;
+
+void miner_config_default(MinerConfig *cfg);
+void miner_set_config(const MinerConfig *cfg);
+const MinerConfig *miner_get_config(void);
+int  miner_thread_count(const MinerConfig *cfg);
+
+//returns 1 when a nonce was found, 0 when cancelled
+int  mine_block_parallel(Block *b, int difficulty, const MinerConfig *cfg,
+                         MinerThreadStats *stats);
+int  mine_block(Block *b, int difficulty);
+
+//rebuild a chain whose transactions were rewritten by a format upgrade:
+//each block gets a fresh merkle root, is linked to the new hash of the
+//block before it and is mined again at its own target. timestamps and
+//targets are kept, so retargeting comes out the same. returns the
+//number of blocks re-mined, or -1 (chain unchanged) if out of memory
+int  mine_reseal_chain(Blockchain *bc);
+
+#endif
@@ -1,9 +1,14 @@
 #include "sha256.h"
 #include <string.h>
-#include <stdio.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SHA256_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
 
 //SHA-256 constants (first 32 bits of cube roots of first 64 primes)
-static const uint32_t K[64] = {
+const uint32_t sha256_k[64] = {
     0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,
     0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
     0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,
@@ -30,7 +35,7 @@ static const uint32_t K[64] = {
 #define SIG0(x)(ROTRIGHT(x,7)  ^ ROTRIGHT(x,18) ^ ((x) >> 3))
 #define SIG1(x)(ROTRIGHT(x,17) ^ ROTRIGHT(x,19) ^ ((x) >> 10))
 
-static void sha256_transform(SHA256_CTX *ctx, const uint8_t *data) {
+void sha256_compress(uint32_t state[8], const uint8_t *data) {
     uint32_t a,b,c,d,e,f,g,h,i,j,t1,t2,m[64];
 
     for (i=0,j=0; i<16; ++i,j+=4)
@@ -39,18 +44,158 @@ static void sha256_transform(SHA256_CTX *ctx, const uint8_t *data) {
     for (; i<64; ++i)
         m[i] = SIG1(m[i-2])+m[i-7]+SIG0(m[i-15])+m[i-16];
 
-    a=ctx->state[0]; b=ctx->state[1]; c=ctx->state[2]; d=ctx->state[3];
-    e=ctx->state[4]; f=ctx->state[5]; g=ctx->state[6]; h=ctx->state[7];
+    a=state[0]; b=state[1]; c=state[2]; d=state[3];
+    e=state[4]; f=state[5]; g=state[6]; h=state[7];
 
     for (i=0; i<64; ++i) {
-        t1 = h+EP1(e)+CH(e,f,g)+K[i]+m[i];
+        t1 = h+EP1(e)+CH(e,f,g)+sha256_k[i]+m[i];
         t2 = EP0(a)+MAJ(a,b,c);
         h=g; g=f; f=e; e=d+t1;
         d=c; c=b; b=a; a=t1+t2;
     }
 
-    ctx->state[0]+=a; ctx->state[1]+=b; ctx->state[2]+=c; ctx->state[3]+=d;
-    ctx->state[4]+=e; ctx->state[5]+=f; ctx->state[6]+=g; ctx->state[7]+=h;
+    state[0]+=a; state[1]+=b; state[2]+=c; state[3]+=d;
+    state[4]+=e; state[5]+=f; state[6]+=g; state[7]+=h;
+}
+
+//SHA-NI (x86 SHA extensions): four rounds per sha256rnds2 pair
+#ifdef SHA256_X86
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(uint32_t state[8], const uint8_t *data,
+                                size_t nblocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                        0x0405060700010203ULL);
+    __m128i STATE0, STATE1, TMP, MSG, W[4], ABEF_SAVE, CDGH_SAVE;
+
+    TMP    = _mm_loadu_si128((const __m128i *)&state[0]);
+    STATE1 = _mm_loadu_si128((const __m128i *)&state[4]);
+    TMP    = _mm_shuffle_epi32(TMP, 0xB1);          /* CDAB */
+    STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);       /* EFGH */
+    STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);       /* ABEF */
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);    /* CDGH */
+
+    while (nblocks--) {
+        ABEF_SAVE = STATE0;
+        CDGH_SAVE = STATE1;
+
+        for (int r = 0; r < 16; r++) {
+            if (r < 4) {
+                W[r] = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i *)(data + 16 * r)), MASK);
+            } else {
+                //W[r] from W[r-4], W[r-3], W[r-2], W[r-1] in the ring
+                TMP = _mm_add_epi32(
+                    _mm_sha256msg1_epu32(W[r & 3], W[(r + 1) & 3]),
+                    _mm_alignr_epi8(W[(r + 3) & 3], W[(r + 2) & 3], 4));
+                W[r & 3] = _mm_sha256msg2_epu32(TMP, W[(r + 3) & 3]);
+            }
+            MSG = _mm_add_epi32(W[r & 3],
+                      _mm_loadu_si128((const __m128i *)&sha256_k[4 * r]));
+            STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+            MSG    = _mm_shuffle_epi32(MSG, 0x0E);
+            STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        }
+
+        STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+        STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+        data += 64;
+    }
+
+    TMP    = _mm_shuffle_epi32(STATE0, 0x1B);       /* FEBA */
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);       /* DCHG */
+    STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);    /* DCBA */
+    STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);       /* ABEF */
+    _mm_storeu_si128((__m128i *)&state[0], STATE0);
+    _mm_storeu_si128((__m128i *)&state[4], STATE1);
+}
+
+static int cpu_has_shani(void) {
+    unsigned int a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) return 0;
+    if (!(c & bit_SSSE3) || !(c & bit_SSE4_1)) return 0;
+    if (!__get_cpuid_count(7, 0, &a, &b, &c, &d)) return 0;
+    return (b & (1u << 29)) != 0;    /* CPUID.(7,0):EBX.SHA */
+}
+#endif
+
+static void sha256_blocks_portable(uint32_t state[8], const uint8_t *data,
+                                   size_t nblocks) {
+    for (; nblocks; nblocks--, data += 64)
+        sha256_compress(state, data);
+}
+
+//runtime dispatch
+typedef void (*sha256_blocks_fn)(uint32_t state[8], const uint8_t *data,
+                                 size_t nblocks);
+static sha256_blocks_fn g_blocks = sha256_blocks_portable;
+static const char      *g_impl   = "portable";
+
+//NIST FIPS 180-2 "abc" and two-block vectors, used to vet a new path
+static int sha256_known_answer(sha256_blocks_fn fn) {
+    static const struct { const char *msg; uint8_t digest[32]; } kat[2] = {
+        { "abc",
+          { 0xba,0x78,0x16,0xbf,0x8f,0x01,0xcf,0xea,0x41,0x41,0x40,0xde,
+            0x5d,0xae,0x22,0x23,0xb0,0x03,0x61,0xa3,0x96,0x17,0x7a,0x9c,
+            0xb4,0x10,0xff,0x61,0xf2,0x00,0x15,0xad } },
+        { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+          { 0x24,0x8d,0x6a,0x61,0xd2,0x06,0x38,0xb8,0xe5,0xc0,0x26,0x93,
+            0x0c,0x3e,0x60,0x39,0xa3,0x3c,0xe4,0x59,0x64,0xff,0x21,0x67,
+            0xf6,0xec,0xed,0xd4,0x19,0xdb,0x06,0xc1 } }
+    };
+
+    for (int i = 0; i < 2; i++) {
+        SHA256_CTX ctx;
+        uint8_t    buf[128];
+        size_t     len  = strlen(kat[i].msg);
+        size_t     nblk = len < 56 ? 1 : 2;
+        uint64_t   bits = (uint64_t)len * 8;
+
+        memset(buf, 0, sizeof(buf));
+        memcpy(buf, kat[i].msg, len);
+        buf[len] = 0x80;
+        for (int j = 0; j < 8; j++)
+            buf[nblk * 64 - 1 - j] = (uint8_t)(bits >> (8 * j));
+
+        sha256_init(&ctx);
+        fn(ctx.state, buf, nblk);
+        for (int j = 0; j < 32; j++)
+            if ((uint8_t)(ctx.state[j / 4] >> (24 - 8 * (j % 4))) !=
+                kat[i].digest[j])
+                return 0;
+    }
+    return 1;
+}
+
+int sha256_select(const char *impl) {
+    int want_auto = (impl == NULL || strcmp(impl, "auto") == 0);
+
+#ifdef SHA256_X86
+    if ((want_auto || strcmp(impl, "sha-ni") == 0) && cpu_has_shani() &&
+        sha256_known_answer(sha256_blocks_shani)) {
+        g_blocks = sha256_blocks_shani;
+        g_impl   = "sha-ni";
+        return 1;
+    }
+#endif
+    if (want_auto || strcmp(impl, "portable") == 0) {
+        g_blocks = sha256_blocks_portable;
+        g_impl   = "portable";
+        return 1;
+    }
+    return 0;
+}
+
+const char *sha256_impl(void) {
+    return g_impl;
+}
+
+__attribute__((constructor))
+static void sha256_dispatch(void) {
+    sha256_select(NULL);
+}
+
+void sha256_blocks(uint32_t state[8], const uint8_t *data, size_t nblocks) {
+    g_blocks(state, data, nblocks);
 }
 
 void sha256_init(SHA256_CTX *ctx) {
@@ -66,17 +211,30 @@ void sha256_init(SHA256_CTX *ctx) {
     ctx->state[7] = 0x5be0cd19;
 }
 
+//whole 64-byte blocks are transformed straight from the input; only a
+//partial head/tail goes through ctx->data
 void sha256_update(SHA256_CTX *ctx, const uint8_t *data, size_t len) {
-    uint32_t i;
-    for (i=0; i<len; ++i) {
-        ctx->data[ctx->datalen] = data[i];
-        ctx->datalen++;
-        if (ctx->datalen == 64) {
-            sha256_transform(ctx, ctx->data);
-            ctx->bitlen += 512;
-            ctx->datalen = 0;
-        }
+    if (ctx->datalen) {
+        size_t take = 64 - ctx->datalen;
+        if (take > len) take = len;
+        memcpy(ctx->data + ctx->datalen, data, take);
+        ctx->datalen += (uint32_t)take;
+        data += take;
+        len  -= take;
+        if (ctx->datalen < 64) return;
+        g_blocks(ctx->state, ctx->data, 1);
+        ctx->bitlen += 512;
+        ctx->datalen = 0;
     }
+    if (len >= 64) {
+        size_t n = len / 64;
+        g_blocks(ctx->state, data, n);
+        ctx->bitlen += 512 * (uint64_t)n;
+        data += 64 * n;
+        len  -= 64 * n;
+    }
+    memcpy(ctx->data, data, len);
+    ctx->datalen = (uint32_t)len;
 }
 
 void sha256_final(SHA256_CTX *ctx, uint8_t *hash) {
@@ -88,7 +246,7 @@ void sha256_final(SHA256_CTX *ctx, uint8_t *hash) {
     } else {
         ctx->data[i++] = 0x80;
         while (i < 64) ctx->data[i++] = 0x00;
-        sha256_transform(ctx, ctx->data);
+        g_blocks(ctx->state, ctx->data, 1);
         memset(ctx->data, 0, 56);
     }
 
@@ -101,7 +259,7 @@ void sha256_final(SHA256_CTX *ctx, uint8_t *hash) {
     ctx->data[58] = (uint8_t)(ctx->bitlen >> 40);
     ctx->data[57] = (uint8_t)(ctx->bitlen >> 48);
     ctx->data[56] = (uint8_t)(ctx->bitlen >> 56);
-    sha256_transform(ctx, ctx->data);
+    g_blocks(ctx->state, ctx->data, 1);
 
     for (i=0; i<4; ++i) {
         hash[i]    = (ctx->state[0] >> (24-i*8)) & 0xff;
@@ -115,6 +273,16 @@ void sha256_final(SHA256_CTX *ctx, uint8_t *hash) {
     }
 }
 
+/* Write a 32-byte digest as a 65-char hex string to output_hex */
+void sha256_digest_hex(const uint8_t *hash, char *output_hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < 32; i++) {
+        output_hex[i*2]     = digits[hash[i] >> 4];
+        output_hex[i*2 + 1] = digits[hash[i] & 0x0f];
+    }
+    output_hex[64] = '\0';
+}
+
 /* Compute SHA-256 of input bytes and write 65-char hex string to output_hex */
 void sha256_hex(const uint8_t *input, size_t len, char *output_hex) {
     SHA256_CTX ctx;
@@ -122,7 +290,5 @@ void sha256_hex(const uint8_t *input, size_t len, char *output_hex) {
     sha256_init(&ctx);
     sha256_update(&ctx, input, len);
     sha256_final(&ctx, hash);
-    for (int i = 0; i < 32; i++)
-        sprintf(output_hex + i*2, "%02x", hash[i]);
-    output_hex[64] = '\0';
+    sha256_digest_hex(hash, output_hex);
 }
\ No newline at end of file
@@ -11,9 +11,30 @@ typedef struct {
     uint32_t state[8];
 } SHA256_CTX;
 
+extern const uint32_t sha256_k[64];
+
 void sha256_init(SHA256_CTX *ctx);
 void sha256_update(SHA256_CTX *ctx, const uint8_t *data, size_t len);
 void sha256_final(SHA256_CTX *ctx, uint8_t *hash);
+void sha256_compress(uint32_t state[8], const uint8_t *data);
+void sha256_blocks(uint32_t state[8], const uint8_t *data, size_t nblocks);
+void sha256_digest_hex(const uint8_t *hash, char *output_hex);
 void sha256_hex(const uint8_t *input, size_t len, char *output_hex);
 
-#endif
\ No newline at end of file
+//single-stream dispatch: "sha-ni" when cpuid reports the x86 SHA
+//extensions, "portable" otherwise
+int  sha256_select(const char *impl);
+const char *sha256_impl(void);
+
+//multi-buffer hashing: up to SHA256_LANES independent messages at once,
+//run in SIMD lanes (AVX2 x8, SSE4.1 x4) when the cpu supports it
+#define SHA256_LANES 8
+
+void sha256_x8(const uint8_t *const msgs[], const size_t lens[], int n,
+               uint8_t digests[][32]);
+void sha256_x8_midstate(const SHA256_CTX *mid, const uint8_t *const tails[],
+                        size_t tail_len, int n, uint8_t digests[][32]);
+int  sha256_x8_select(const char *impl);
+const char *sha256_x8_impl(void);
+
+#endif
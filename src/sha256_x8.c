@@ -0,0 +1,291 @@
+#include "sha256.h"
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SHA256_X86 1
+#include <immintrin.h>
+#endif
+
+//state is word-major: st[word][lane]
+typedef void (*compress_x8_fn)(uint32_t st[8][SHA256_LANES],
+                               const uint8_t *const blk[SHA256_LANES]);
+
+static const uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static uint32_t load_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8)  |  (uint32_t)p[3];
+}
+
+//fallback: one lane at a time through the single-stream path
+static void compress_x8_scalar(uint32_t st[8][SHA256_LANES],
+                               const uint8_t *const blk[SHA256_LANES]) {
+    for (int l = 0; l < SHA256_LANES; l++) {
+        uint32_t s[8];
+        for (int w = 0; w < 8; w++) s[w] = st[w][l];
+        sha256_blocks(s, blk[l], 1);
+        for (int w = 0; w < 8; w++) st[w][l] = s[w];
+    }
+}
+
+#ifdef SHA256_X86
+
+//round functions written against the vector ops defined per kernel below
+#define X_ROTR(x,n)  X_OR(X_SRL(x,n), X_SLL(x,32-(n)))
+#define X_CH(x,y,z)  X_XOR(X_AND(x,y), X_ANDN(x,z))
+#define X_MAJ(x,y,z) X_XOR(X_XOR(X_AND(x,y), X_AND(x,z)), X_AND(y,z))
+#define X_EP0(x)  X_XOR(X_XOR(X_ROTR(x,2),  X_ROTR(x,13)), X_ROTR(x,22))
+#define X_EP1(x)  X_XOR(X_XOR(X_ROTR(x,6),  X_ROTR(x,11)), X_ROTR(x,25))
+#define X_SIG0(x) X_XOR(X_XOR(X_ROTR(x,7),  X_ROTR(x,18)), X_SRL(x,3))
+#define X_SIG1(x) X_XOR(X_XOR(X_ROTR(x,17), X_ROTR(x,19)), X_SRL(x,10))
+
+//AVX2: all 8 lanes in one __m256i per word
+#define X_ADD(a,b)  _mm256_add_epi32(a,b)
+#define X_XOR(a,b)  _mm256_xor_si256(a,b)
+#define X_AND(a,b)  _mm256_and_si256(a,b)
+#define X_ANDN(a,b) _mm256_andnot_si256(a,b)
+#define X_OR(a,b)   _mm256_or_si256(a,b)
+#define X_SRL(a,n)  _mm256_srli_epi32(a,n)
+#define X_SLL(a,n)  _mm256_slli_epi32(a,n)
+
+__attribute__((target("avx2")))
+static void compress_x8_avx2(uint32_t st[8][SHA256_LANES],
+                             const uint8_t *const blk[SHA256_LANES]) {
+    __m256i w[16], s[8];
+    uint32_t tmp[SHA256_LANES];
+
+    for (int j = 0; j < 16; j++) {
+        for (int l = 0; l < SHA256_LANES; l++)
+            tmp[l] = load_be32(blk[l] + 4 * j);
+        w[j] = _mm256_loadu_si256((const __m256i *)tmp);
+    }
+    for (int i = 0; i < 8; i++)
+        s[i] = _mm256_loadu_si256((const __m256i *)st[i]);
+
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3];
+    __m256i e = s[4], f = s[5], g = s[6], h = s[7];
+
+    for (int i = 0; i < 64; i++) {
+        if (i >= 16)
+            w[i & 15] = X_ADD(X_ADD(X_SIG1(w[(i - 2) & 15]), w[(i - 7) & 15]),
+                              X_ADD(X_SIG0(w[(i - 15) & 15]), w[i & 15]));
+        __m256i t1 = X_ADD(X_ADD(X_ADD(h, X_EP1(e)), X_CH(e, f, g)),
+                           X_ADD(_mm256_set1_epi32((int)sha256_k[i]),
+                                 w[i & 15]));
+        __m256i t2 = X_ADD(X_EP0(a), X_MAJ(a, b, c));
+        h = g; g = f; f = e; e = X_ADD(d, t1);
+        d = c; c = b; b = a; a = X_ADD(t1, t2);
+    }
+
+    s[0] = X_ADD(s[0], a); s[1] = X_ADD(s[1], b);
+    s[2] = X_ADD(s[2], c); s[3] = X_ADD(s[3], d);
+    s[4] = X_ADD(s[4], e); s[5] = X_ADD(s[5], f);
+    s[6] = X_ADD(s[6], g); s[7] = X_ADD(s[7], h);
+    for (int i = 0; i < 8; i++)
+        _mm256_storeu_si256((__m256i *)st[i], s[i]);
+}
+
+#undef X_ADD
+#undef X_XOR
+#undef X_AND
+#undef X_ANDN
+#undef X_OR
+#undef X_SRL
+#undef X_SLL
+
+//SSE4.1: 4 lanes per __m128i, two passes cover all 8 lanes
+#define X_ADD(a,b)  _mm_add_epi32(a,b)
+#define X_XOR(a,b)  _mm_xor_si128(a,b)
+#define X_AND(a,b)  _mm_and_si128(a,b)
+#define X_ANDN(a,b) _mm_andnot_si128(a,b)
+#define X_OR(a,b)   _mm_or_si128(a,b)
+#define X_SRL(a,n)  _mm_srli_epi32(a,n)
+#define X_SLL(a,n)  _mm_slli_epi32(a,n)
+
+__attribute__((target("sse4.1")))
+static void compress_x8_sse41(uint32_t st[8][SHA256_LANES],
+                              const uint8_t *const blk[SHA256_LANES]) {
+    for (int base = 0; base < SHA256_LANES; base += 4) {
+        __m128i w[16], s[8];
+        uint32_t tmp[4];
+
+        for (int j = 0; j < 16; j++) {
+            for (int l = 0; l < 4; l++)
+                tmp[l] = load_be32(blk[base + l] + 4 * j);
+            w[j] = _mm_loadu_si128((const __m128i *)tmp);
+        }
+        for (int i = 0; i < 8; i++)
+            s[i] = _mm_loadu_si128((const __m128i *)&st[i][base]);
+
+        __m128i a = s[0], b = s[1], c = s[2], d = s[3];
+        __m128i e = s[4], f = s[5], g = s[6], h = s[7];
+
+        for (int i = 0; i < 64; i++) {
+            if (i >= 16)
+                w[i & 15] = X_ADD(X_ADD(X_SIG1(w[(i - 2) & 15]),
+                                        w[(i - 7) & 15]),
+                                  X_ADD(X_SIG0(w[(i - 15) & 15]), w[i & 15]));
+            __m128i t1 = X_ADD(X_ADD(X_ADD(h, X_EP1(e)), X_CH(e, f, g)),
+                               X_ADD(_mm_set1_epi32((int)sha256_k[i]),
+                                     w[i & 15]));
+            __m128i t2 = X_ADD(X_EP0(a), X_MAJ(a, b, c));
+            h = g; g = f; f = e; e = X_ADD(d, t1);
+            d = c; c = b; b = a; a = X_ADD(t1, t2);
+        }
+
+        s[0] = X_ADD(s[0], a); s[1] = X_ADD(s[1], b);
+        s[2] = X_ADD(s[2], c); s[3] = X_ADD(s[3], d);
+        s[4] = X_ADD(s[4], e); s[5] = X_ADD(s[5], f);
+        s[6] = X_ADD(s[6], g); s[7] = X_ADD(s[7], h);
+        for (int i = 0; i < 8; i++)
+            _mm_storeu_si128((__m128i *)&st[i][base], s[i]);
+    }
+}
+
+#endif /* SHA256_X86 */
+
+//runtime dispatch
+static compress_x8_fn g_compress_x8 = compress_x8_scalar;
+static const char    *g_impl        = "scalar";
+
+int sha256_x8_select(const char *impl) {
+    int want_auto = (impl == NULL || strcmp(impl, "auto") == 0);
+
+#ifdef SHA256_X86
+    __builtin_cpu_init();
+    if ((want_auto || strcmp(impl, "avx2") == 0) &&
+        __builtin_cpu_supports("avx2")) {
+        g_compress_x8 = compress_x8_avx2;
+        g_impl        = "avx2";
+        return 1;
+    }
+    if ((want_auto || strcmp(impl, "sse4.1") == 0) &&
+        __builtin_cpu_supports("sse4.1")) {
+        g_compress_x8 = compress_x8_sse41;
+        g_impl        = "sse4.1";
+        return 1;
+    }
+#endif
+    if (want_auto || strcmp(impl, "scalar") == 0) {
+        g_compress_x8 = compress_x8_scalar;
+        g_impl        = "scalar";
+        return 1;
+    }
+    return 0;
+}
+
+const char *sha256_x8_impl(void) {
+    return g_impl;
+}
+
+__attribute__((constructor))
+static void sha256_x8_dispatch(void) {
+    sha256_x8_select(NULL);
+}
+
+//hash up to 8 messages that all start from init (after prefix_bits of
+//already absorbed input); lanes beyond n are ignored
+static void hash_lanes(const uint32_t init[8], uint64_t prefix_bits,
+                       const uint8_t *const msgs[], const size_t lens[],
+                       int n, uint8_t digests[][32]) {
+    uint32_t       st[8][SHA256_LANES];
+    uint8_t        pad[SHA256_LANES][128];
+    size_t         full[SHA256_LANES], nblk[SHA256_LANES], maxblk = 0;
+    const uint8_t *blk[SHA256_LANES];
+
+    for (int l = 0; l < SHA256_LANES; l++) {
+        int src = l < n ? l : 0;   /* idle lanes shadow lane 0 */
+        size_t len = lens[src];
+        size_t rem = len % 64;
+        uint64_t bits = prefix_bits + (uint64_t)len * 8;
+
+        full[l] = len / 64;
+        memset(pad[l], 0, sizeof(pad[l]));
+        memcpy(pad[l], msgs[src] + full[l] * 64, rem);
+        pad[l][rem] = 0x80;
+        size_t tail = rem < 56 ? 1 : 2;
+        for (int i = 0; i < 8; i++)
+            pad[l][tail * 64 - 1 - i] = (uint8_t)(bits >> (8 * i));
+        nblk[l] = full[l] + tail;
+        if (l < n && nblk[l] > maxblk) maxblk = nblk[l];
+
+        for (int w = 0; w < 8; w++) st[w][l] = init[w];
+    }
+
+    for (size_t k = 0; k < maxblk; k++) {
+        int active = 0;
+        for (int l = 0; l < SHA256_LANES; l++) {
+            int src = l < n ? l : 0;
+            if (k < full[l])      blk[l] = msgs[src] + k * 64;
+            else if (k < nblk[l]) blk[l] = pad[l] + (k - full[l]) * 64;
+            else                  blk[l] = pad[l];
+            if (l < n && k < nblk[l]) active++;
+        }
+
+        if (active == n && n == SHA256_LANES) {
+            g_compress_x8(st, blk);
+            continue;
+        }
+        if (active * 2 < SHA256_LANES) {
+            //too few lanes left to be worth a vector pass
+            for (int l = 0; l < n; l++) {
+                if (k >= nblk[l]) continue;
+                uint32_t s[8];
+                for (int w = 0; w < 8; w++) s[w] = st[w][l];
+                sha256_blocks(s, blk[l], 1);
+                for (int w = 0; w < 8; w++) st[w][l] = s[w];
+            }
+            continue;
+        }
+        //vector pass, then restore the lanes that had already finished
+        uint32_t saved[8][SHA256_LANES];
+        memcpy(saved, st, sizeof(saved));
+        g_compress_x8(st, blk);
+        for (int l = 0; l < SHA256_LANES; l++)
+            if (l >= n || k >= nblk[l])
+                for (int w = 0; w < 8; w++) st[w][l] = saved[w][l];
+    }
+
+    for (int l = 0; l < n; l++)
+        for (int w = 0; w < 8; w++) {
+            digests[l][w*4]     = (uint8_t)(st[w][l] >> 24);
+            digests[l][w*4 + 1] = (uint8_t)(st[w][l] >> 16);
+            digests[l][w*4 + 2] = (uint8_t)(st[w][l] >> 8);
+            digests[l][w*4 + 3] = (uint8_t)(st[w][l]);
+        }
+}
+
+//hash n independent messages, 8 at a time
+void sha256_x8(const uint8_t *const msgs[], const size_t lens[], int n,
+               uint8_t digests[][32]) {
+    for (int base = 0; base < n; base += SHA256_LANES) {
+        int m = n - base < SHA256_LANES ? n - base : SHA256_LANES;
+        hash_lanes(IV, 0, msgs + base, lens + base, m, digests + base);
+    }
+}
+
+//hash n messages that share an already absorbed prefix: lane i is the
+//prefix in mid followed by tails[i]
+void sha256_x8_midstate(const SHA256_CTX *mid, const uint8_t *const tails[],
+                        size_t tail_len, int n, uint8_t digests[][32]) {
+    size_t lens[SHA256_LANES];
+    for (int l = 0; l < SHA256_LANES; l++) lens[l] = tail_len;
+
+    if (mid->datalen != 0) {
+        //midstate not on a chunk boundary, finish each lane normally
+        for (int l = 0; l < n; l++) {
+            SHA256_CTX ctx = *mid;
+            sha256_update(&ctx, tails[l], tail_len);
+            sha256_final(&ctx, digests[l]);
+        }
+        return;
+    }
+    for (int base = 0; base < n; base += SHA256_LANES) {
+        int m = n - base < SHA256_LANES ? n - base : SHA256_LANES;
+        hash_lanes(mid->state, mid->bitlen, tails + base, lens, m,
+                   digests + base);
+    }
+}
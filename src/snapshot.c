@@ -0,0 +1,278 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC   "ALUSTATE"
+#define SNAPSHOT_VERSION 1
+//how often the writer looks at the chain's length, in seconds
+#define SNAPSHOT_POLL_S  1
+
+//the header padded to 8, then the strings (str_write_image), then the
+//index (index_write)
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    int32_t  height;
+    char     tip_hash[HASH_HEX_LEN];
+} SnapHeader;
+
+#define SNAP_HEADER_BYTES ((sizeof(SnapHeader) + 7) & ~(size_t)7)
+
+//reading
+
+//mapped privately: the index works on its arrays in place, and only
+//what gets changed is copied
+int snapshot_load(Snapshot *s, LedgerIndex *idx, const char *path) {
+    SnapHeader  h;
+    struct stat st;
+    memset(s, 0, sizeof(*s));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > SNAP_HEADER_BYTES)
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    size_t len = (size_t)st.st_size;
+    memcpy(&h, map, sizeof(h));
+    size_t strings = memcmp(h.magic, SNAPSHOT_MAGIC, 8) == 0 &&
+                     h.version == SNAPSHOT_VERSION && h.height > 0
+                     ? str_read_image((char *)map + SNAP_HEADER_BYTES,
+                                      len - SNAP_HEADER_BYTES)
+                     : 0;
+    if (!strings ||
+        !index_read(idx, map, len, SNAP_HEADER_BYTES + strings, h.height)) {
+        if (strings) str_free_all();
+        munmap(map, len);
+        return 0;
+    }
+
+    s->height = h.height;
+    memcpy(s->tip_hash, h.tip_hash, HASH_HEX_LEN);
+    s->tip_hash[HASH_HEX_LEN - 1] = '\0';
+    return 1;
+}
+
+int snapshot_matches(const Snapshot *s, const Blockchain *bc) {
+    return s->height <= bc->length &&
+           strcmp(blockchain_block(bc, s->height - 1)->hash,
+                  s->tip_hash) == 0;
+}
+
+//writing
+
+//what a snapshot is taken from: the blocks from first up to height and
+//the string behind every handle, copied out while the chain holds still.
+//blocks and strings never move, so the copies stay good after that
+typedef struct {
+    const Block **blocks;        /* blocks[0] is block first */
+    int           first;
+    int           height;
+    const char  **strings;
+    StrId         limit;
+} SnapSource;
+
+static void source_free(SnapSource *src) {
+    free(src->blocks);
+    free(src->strings);
+    memset(src, 0, sizeof(*src));
+}
+
+static int source_copy(SnapSource *src, const Blockchain *bc, int first) {
+    memset(src, 0, sizeof(*src));
+    if (bc->length == 0 || first > bc->length) return 0;
+    src->first   = first;
+    src->height  = bc->length;
+    src->limit   = str_limit();
+    src->blocks  = malloc((size_t)(src->height - first + 1) *
+                          sizeof(*src->blocks));
+    src->strings = malloc((size_t)src->limit * sizeof(*src->strings));
+    if (!src->blocks || !src->strings) {
+        fprintf(stderr, "Error: out of memory taking a state snapshot.\n");
+        source_free(src);
+        return 0;
+    }
+    for (int i = first; i < src->height; i++)
+        src->blocks[i - first] = blockchain_block(bc, i);
+    for (StrId id = 0; id < src->limit; id++)
+        src->strings[id] = str_get(id);
+    return 1;
+}
+
+static int state_init(SnapIndex *s) {
+    memset(s, 0, sizeof(*s));
+    return index_init(&s->idx);
+}
+
+static void state_free(SnapIndex *s) {
+    index_free(&s->idx);
+    free(s->used);
+    memset(s, 0, sizeof(*s));
+}
+
+static void mark_used(uint8_t *used, StrId id, StrId limit) {
+    if (id != STR_NONE && id < limit)
+        used[id / 8] |= (uint8_t)(1u << (id % 8));
+}
+
+//index the copied blocks s does not have yet and mark the strings they
+//use; 0 if it ran out of memory, and s has to start again from genesis
+static int state_add(SnapIndex *s, const SnapSource *src) {
+    if (!s->used || src->limit > s->limit) {
+        size_t   have = s->used ? (size_t)s->limit / 8 + 1 : 0;
+        size_t   need = (size_t)src->limit / 8 + 1;
+        uint8_t *used = realloc(s->used, need);
+        if (!used) return 0;
+        memset(used + have, 0, need - have);
+        s->used  = used;
+        s->limit = src->limit;
+    }
+    for (int i = s->height; i < src->height; i++) {
+        const Block *b = src->blocks[i - src->first];
+        index_add_block(&s->idx, i, b);
+        for (int j = 0; j < b->tx_count; j++) {
+            mark_used(s->used, b->transactions[j].student, s->limit);
+            mark_used(s->used, b->transactions[j].invoice, s->limit);
+            mark_used(s->used, b->transactions[j].reference, s->limit);
+        }
+    }
+    s->height = src->height;
+    return s->idx.valid;
+}
+
+//bring s up to the copied blocks and write it out with every string the
+//blocks use, to <path>.tmp first and renamed into place
+static int source_write(SnapSource *src, SnapIndex *s, const char *path) {
+    SnapHeader h;
+    char       tmp[280];
+
+    if (!state_add(s, src)) {
+        fprintf(stderr, "Error: out of memory taking a state snapshot.\n");
+        state_free(s);
+        state_init(s);
+        return 0;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, 8);
+    h.version = SNAPSHOT_VERSION;
+    h.height  = src->height;
+    memcpy(h.tip_hash, src->blocks[src->height - 1 - src->first]->hash,
+           HASH_HEX_LEN);
+    //strings only pending transactions use stay out
+    for (StrId id = 1; id < src->limit; id++)
+        if (!(s->used[id / 8] >> (id % 8) & 1)) src->strings[id] = NULL;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    static const char zero[8];
+    int ok = f && fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fwrite(zero, 1, SNAP_HEADER_BYTES - sizeof(h), f) ==
+                 SNAP_HEADER_BYTES - sizeof(h) &&
+             str_write_image(f, src->strings, src->limit) &&
+             index_write(&s->idx, f) && fflush(f) == 0 &&
+             fsync(fileno(f)) == 0;
+    if (f && fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp, path) != 0) {
+        perror("snapshot_save");
+        remove(tmp);
+        ok = 0;
+    }
+    return ok;
+}
+
+int snapshot_save(const Blockchain *bc, const char *path) {
+    SnapSource src;
+    SnapIndex  s;
+    if (!state_init(&s) || !source_copy(&src, bc, 0)) {
+        state_free(&s);
+        return 0;
+    }
+    int ok = source_write(&src, &s, path);
+    source_free(&src);
+    state_free(&s);
+    return ok;
+}
+
+//background writer
+
+static void *snapshotter_main(void *arg) {
+    Snapshotter *sn = arg;
+
+    pthread_mutex_lock(&sn->lock);
+    while (!sn->stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += SNAPSHOT_POLL_S;
+        pthread_cond_timedwait(&sn->wake, &sn->lock, &ts);
+        if (sn->stop) break;
+        pthread_mutex_unlock(&sn->lock);
+
+        SnapSource src;
+        pthread_mutex_lock(sn->chain_lock);
+        int due = sn->bc->length - sn->height >= sn->every &&
+                  source_copy(&src, sn->bc, sn->state.height);
+        pthread_mutex_unlock(sn->chain_lock);
+        //a failed write is tried again `every` blocks later
+        if (due) {
+            source_write(&src, &sn->state, sn->path);
+            sn->height = src.height;
+            source_free(&src);
+        }
+        pthread_mutex_lock(&sn->lock);
+    }
+    pthread_mutex_unlock(&sn->lock);
+    return NULL;
+}
+
+int snapshotter_start(Snapshotter *sn, const Blockchain *bc,
+                      pthread_mutex_t *chain_lock, const char *path,
+                      int every, int height) {
+    memset(sn, 0, sizeof(*sn));
+    sn->bc         = bc;
+    sn->chain_lock = chain_lock;
+    sn->every      = every > 0 ? every : 1;
+    sn->height     = height;
+    snprintf(sn->path, sizeof(sn->path), "%s", path);
+    if (!state_init(&sn->state)) {
+        fprintf(stderr, "Error: out of memory starting the snapshot "
+                        "thread.\n");
+        state_free(&sn->state);
+        return 0;
+    }
+    pthread_mutex_init(&sn->lock, NULL);
+    pthread_cond_init(&sn->wake, NULL);
+    if (pthread_create(&sn->thread, NULL, snapshotter_main, sn) != 0) {
+        fprintf(stderr, "Error: could not start the snapshot thread.\n");
+        pthread_cond_destroy(&sn->wake);
+        pthread_mutex_destroy(&sn->lock);
+        state_free(&sn->state);
+        return 0;
+    }
+    sn->started = 1;
+    return 1;
+}
+
+void snapshotter_stop(Snapshotter *sn) {
+    if (!sn->started) return;
+    pthread_mutex_lock(&sn->lock);
+    sn->stop = 1;
+    pthread_cond_signal(&sn->wake);
+    pthread_mutex_unlock(&sn->lock);
+    pthread_join(sn->thread, NULL);
+    pthread_cond_destroy(&sn->wake);
+    pthread_mutex_destroy(&sn->lock);
+    state_free(&sn->state);
+    sn->started = 0;
+}
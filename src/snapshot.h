@@ -0,0 +1,70 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <pthread.h>
+#include "blockchain.h"
+#include "index.h"
+
+//state snapshot: the invoice index (index.h) as it stood after the
+//chain's first height blocks, the strings those blocks use, and the hash
+//of block height-1 as its anchor. startup reads it back and only indexes
+//the blocks after it instead of replaying the whole chain; opened with
+//--mmap, only the block headers it covers are paged in. a snapshot whose
+//anchor is not in the chain is ignored. it holds mined state only, the
+//pending pool is indexed on top of it as before
+#define DEFAULT_SNAPSHOT_EVERY 100
+
+typedef struct {
+    int  height;
+    char tip_hash[HASH_HEX_LEN];
+} Snapshot;
+
+//read path into s, idx (which must be unused) and the string table
+//(which must be empty), before the chain is opened with s.height known
+//blocks (chainlog_open); 0 if it is missing, from another version or
+//damaged, with idx and the table left empty
+int  snapshot_load(Snapshot *s, LedgerIndex *idx, const char *path);
+//whether bc holds the block s was taken at; if not, the chain has to be
+//opened again without s
+int  snapshot_matches(const Snapshot *s, const Blockchain *bc);
+
+//snapshot of bc as it is now, written before returning
+int  snapshot_save(const Blockchain *bc, const char *path);
+
+//what the background writer has indexed so far: mined blocks only, in an
+//index of its own, with a bit per string they use
+typedef struct {
+    LedgerIndex idx;
+    int         height;      /* blocks in idx */
+    uint8_t    *used;
+    StrId       limit;       /* strings used has room for */
+} SnapIndex;
+
+//background writer: a thread that takes a snapshot whenever the chain
+//has grown `every` blocks past the last one. it holds chain_lock (the
+//miner's) only to copy out the blocks added since, adds those to its
+//own index and writes that without the lock. so a snapshot costs the
+//new blocks plus the write, except the first one of a run, which
+//indexes the chain from genesis
+typedef struct {
+    const Blockchain *bc;
+    pthread_mutex_t  *chain_lock;
+    char              path[256];
+    int               every;
+    int               height;      /* chain length at the last snapshot */
+    int               stop;
+    int               started;
+    SnapIndex         state;       /* only the thread touches it */
+    pthread_mutex_t   lock;        /* guards stop */
+    pthread_cond_t    wake;
+    pthread_t         thread;
+} Snapshotter;
+
+//height is where the snapshot on disk was taken, 0 if there is none
+int  snapshotter_start(Snapshotter *sn, const Blockchain *bc,
+                       pthread_mutex_t *chain_lock, const char *path,
+                       int every, int height);
+//waits for a snapshot being written; call without chain_lock
+void snapshotter_stop(Snapshotter *sn);
+
+#endif
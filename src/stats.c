@@ -0,0 +1,240 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+
+#if ALU_STATS
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[STAT_BUCKETS];
+} StatHist;
+
+typedef struct {
+    int64_t second;
+    int     depth;      /* deepest seen in that second */
+} DepthSample;
+
+uint64_t stat_counters[STAT_COUNTERS];
+static StatHist hists[STAT_TIMERS];
+
+static const char *const counter_names[STAT_COUNTERS] = {
+    "hashes", "mine_ns", "blocks_mined", "lookups", "scanned_txs"
+};
+static const char *const timer_names[STAT_TIMERS] = {
+    "compute_block_hash", "mine_block", "chain_save", "chain_load",
+    "blockchain_verify"
+};
+
+//the ring is only locked when a new second starts or a sample deepens;
+//depth_second and depth_max are its newest entry, readable without it
+static pthread_mutex_t depth_lock = PTHREAD_MUTEX_INITIALIZER;
+static DepthSample     depth_ring[STAT_DEPTH_SECONDS];
+static int             depth_count;   /* samples held, newest at head-1 */
+static int             depth_head;
+static int64_t         depth_second = -1;
+static int             depth_max;
+static int             depth_now;
+static int             depth_peak;
+
+uint64_t stat_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int bucket_of(uint64_t ns) {
+    int b = ns ? 63 - __builtin_clzll(ns) : 0;
+    return b < STAT_BUCKETS ? b : STAT_BUCKETS - 1;
+}
+
+void stat_record(StatTimer t, uint64_t ns) {
+    StatHist *h = &hists[t];
+    __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->buckets[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+    while (ns > max &&
+           !__atomic_compare_exchange_n(&h->max_ns, &max, ns, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void stat_pool_depth(int depth) {
+    int64_t now = (int64_t)time(NULL);
+    __atomic_store_n(&depth_now, depth, __ATOMIC_RELAXED);
+    int peak = __atomic_load_n(&depth_peak, __ATOMIC_RELAXED);
+    while (depth > peak &&
+           !__atomic_compare_exchange_n(&depth_peak, &peak, depth, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    if (__atomic_load_n(&depth_second, __ATOMIC_RELAXED) == now &&
+        __atomic_load_n(&depth_max, __ATOMIC_RELAXED) >= depth)
+        return;
+
+    pthread_mutex_lock(&depth_lock);
+    if (depth_second != now) {
+        if (depth_count < STAT_DEPTH_SECONDS) depth_count++;
+        depth_head = (depth_head + 1) % STAT_DEPTH_SECONDS;
+        __atomic_store_n(&depth_second, now, __ATOMIC_RELAXED);
+        __atomic_store_n(&depth_max, depth, __ATOMIC_RELAXED);
+    } else if (depth > depth_max) {
+        __atomic_store_n(&depth_max, depth, __ATOMIC_RELAXED);
+    }
+    int newest = (depth_head + STAT_DEPTH_SECONDS - 1) % STAT_DEPTH_SECONDS;
+    depth_ring[newest].second = now;
+    depth_ring[newest].depth  = depth_max;
+    pthread_mutex_unlock(&depth_lock);
+}
+
+//reading
+
+//a consistent enough copy: each field is read atomically, but calls
+//still in flight may show in one field and not yet in another
+typedef struct {
+    uint64_t    counters[STAT_COUNTERS];
+    StatHist    hists[STAT_TIMERS];
+    DepthSample depth[STAT_DEPTH_SECONDS];   /* oldest first */
+    int         depth_count;
+    int         depth_now;
+    int         depth_peak;
+} StatView;
+
+static void view_take(StatView *v) {
+    memset(v, 0, sizeof(*v));
+    for (int c = 0; c < STAT_COUNTERS; c++)
+        v->counters[c] = __atomic_load_n(&stat_counters[c], __ATOMIC_RELAXED);
+    for (int t = 0; t < STAT_TIMERS; t++) {
+        const StatHist *h = &hists[t];
+        v->hists[t].count    = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+        v->hists[t].total_ns = __atomic_load_n(&h->total_ns,
+                                               __ATOMIC_RELAXED);
+        v->hists[t].max_ns   = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+        for (int b = 0; b < STAT_BUCKETS; b++)
+            v->hists[t].buckets[b] = __atomic_load_n(&h->buckets[b],
+                                                     __ATOMIC_RELAXED);
+    }
+    pthread_mutex_lock(&depth_lock);
+    v->depth_count = depth_count;
+    for (int i = 0; i < depth_count; i++)
+        v->depth[i] = depth_ring[(depth_head - depth_count + i +
+                                  STAT_DEPTH_SECONDS) % STAT_DEPTH_SECONDS];
+    pthread_mutex_unlock(&depth_lock);
+    v->depth_now  = __atomic_load_n(&depth_now, __ATOMIC_RELAXED);
+    v->depth_peak = __atomic_load_n(&depth_peak, __ATOMIC_RELAXED);
+}
+
+//upper bound of the bucket the q-th fraction of calls falls in, in us
+static double quantile_us(const StatHist *h, double q) {
+    uint64_t want = (uint64_t)(q * (double)h->count + 0.5), seen = 0;
+    if (want < 1) want = 1;
+    for (int b = 0; b < STAT_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= want) {
+            double hi = (double)(2ULL << b) / 1e3;
+            return b == STAT_BUCKETS - 1 || hi > h->max_ns / 1e3
+                   ? (double)h->max_ns / 1e3 : hi;
+        }
+    }
+    return (double)h->max_ns / 1e3;
+}
+
+static double mean_us(const StatHist *h) {
+    return h->count ? (double)h->total_ns / (double)h->count / 1e3 : 0;
+}
+
+static double hash_rate(const StatView *v) {
+    return v->counters[STAT_MINE_NS]
+           ? (double)v->counters[STAT_HASHES] * 1e9 /
+                 (double)v->counters[STAT_MINE_NS]
+           : 0;
+}
+
+void stats_print(void) {
+    StatView v;
+    view_take(&v);
+
+    printf("\n--- Statistics ---\n");
+    printf("  Mining    : %llu hashes in %llu block(s), %.0f H/s while "
+           "searching\n", (unsigned long long)v.counters[STAT_HASHES],
+           (unsigned long long)v.counters[STAT_BLOCKS_MINED], hash_rate(&v));
+    printf("  Lookups   : %llu, %llu transaction(s) looked at (%.1f each)\n",
+           (unsigned long long)v.counters[STAT_LOOKUPS],
+           (unsigned long long)v.counters[STAT_SCANNED_TXS],
+           v.counters[STAT_LOOKUPS]
+           ? (double)v.counters[STAT_SCANNED_TXS] /
+                 (double)v.counters[STAT_LOOKUPS]
+           : 0.0);
+    printf("  Pool depth: %d now, %d at most\n", v.depth_now, v.depth_peak);
+
+    printf("  %-20s %10s %12s %12s %12s %12s\n", "latency (us)", "calls",
+           "mean", "p50", "p99", "max");
+    for (int t = 0; t < STAT_TIMERS; t++) {
+        const StatHist *h = &v.hists[t];
+        if (!h->count) {
+            printf("  %-20s %10s\n", timer_names[t], "-");
+            continue;
+        }
+        printf("  %-20s %10llu %12.1f %12.1f %12.1f %12.1f\n",
+               timer_names[t], (unsigned long long)h->count, mean_us(h),
+               quantile_us(h, 0.5), quantile_us(h, 0.99),
+               (double)h->max_ns / 1e3);
+    }
+}
+
+int stats_write_json(const char *path) {
+    StatView v;
+    view_take(&v);
+
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return 0;
+    }
+    fprintf(f, "{\n  \"counters\": {");
+    for (int c = 0; c < STAT_COUNTERS; c++)
+        fprintf(f, "%s\"%s\": %llu", c ? ", " : "", counter_names[c],
+                (unsigned long long)v.counters[c]);
+    fprintf(f, ", \"hashes_per_s\": %.0f},\n  \"timers\": {", hash_rate(&v));
+
+    //each histogram as [bucket floor in ns, calls] for non-empty buckets
+    for (int t = 0; t < STAT_TIMERS; t++) {
+        const StatHist *h = &v.hists[t];
+        fprintf(f, "%s\n    \"%s\": {\"count\": %llu, \"mean_us\": %.3f, "
+                   "\"p50_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f, "
+                   "\"buckets\": [",
+                t ? "," : "", timer_names[t], (unsigned long long)h->count,
+                mean_us(h), h->count ? quantile_us(h, 0.5) : 0.0,
+                h->count ? quantile_us(h, 0.99) : 0.0,
+                (double)h->max_ns / 1e3);
+        for (int b = 0, first = 1; b < STAT_BUCKETS; b++) {
+            if (!h->buckets[b]) continue;
+            fprintf(f, "%s[%llu, %llu]", first ? "" : ", ",
+                    b ? 1ULL << b : 0ULL,
+                    (unsigned long long)h->buckets[b]);
+            first = 0;
+        }
+        fprintf(f, "]}");
+    }
+
+    fprintf(f, "\n  },\n  \"pool_depth\": {\"now\": %d, \"peak\": %d, "
+               "\"per_second\": [", v.depth_now, v.depth_peak);
+    for (int i = 0; i < v.depth_count; i++)
+        fprintf(f, "%s[%lld, %d]", i ? ", " : "",
+                (long long)v.depth[i].second, v.depth[i].depth);
+    fprintf(f, "]}\n}\n");
+
+    if (fclose(f) != 0) {
+        perror(path);
+        return 0;
+    }
+    return 1;
+}
+
+#endif
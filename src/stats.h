@@ -0,0 +1,70 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+//hot-path instrumentation: process-wide counters and latency histograms,
+//updated with relaxed atomics from any thread. the `stats` command prints
+//them and the program writes them as JSON on exit. built with
+//ALU_STATS=0 (make STATS=0) every hook below compiles to nothing
+#ifndef ALU_STATS
+#define ALU_STATS 1
+#endif
+
+typedef enum {
+    STAT_HASHES,        /* nonces tried by the miner */
+    STAT_MINE_NS,       /* time spent searching for them */
+    STAT_BLOCKS_MINED,
+    STAT_LOOKUPS,       /* invoice and student walks started */
+    STAT_SCANNED_TXS,   /* transactions those walks looked at */
+    STAT_COUNTERS
+} StatCounter;
+
+typedef enum {
+    TIMER_BLOCK_HASH,   /* compute_block_hash */
+    TIMER_MINE,         /* one mining search, found or cancelled */
+    TIMER_CHAIN_SAVE,   /* chainlog_create and chainlog_append that worked */
+    TIMER_CHAIN_LOAD,   /* chainlog_open of a current log that worked */
+    TIMER_VERIFY,       /* blockchain_verify */
+    STAT_TIMERS
+} StatTimer;
+
+//bucket i counts calls that took [2^i, 2^(i+1)) ns; the last one also
+//takes anything longer (2^40 ns is about 18 minutes)
+#define STAT_BUCKETS 41
+
+//pool depth over time: the deepest the pool was in each of the last
+//STAT_DEPTH_SECONDS seconds in which it changed
+#define STAT_DEPTH_SECONDS 120
+
+#if ALU_STATS
+
+extern uint64_t stat_counters[STAT_COUNTERS];
+
+static inline void stat_add(StatCounter c, uint64_t n) {
+    __atomic_add_fetch(&stat_counters[c], n, __ATOMIC_RELAXED);
+}
+
+uint64_t stat_now_ns(void);
+void     stat_record(StatTimer t, uint64_t ns);
+void     stat_pool_depth(int depth);
+
+#define STAT_ADD(c, n)        stat_add((c), (uint64_t)(n))
+#define STAT_TIME_START(v)    uint64_t v = stat_now_ns()
+#define STAT_TIME_STOP(t, v)  stat_record((t), stat_now_ns() - (v))
+#define STAT_POOL_DEPTH(d)    stat_pool_depth(d)
+
+//the `stats` report on stdout, and the same as JSON in path
+void stats_print(void);
+int  stats_write_json(const char *path);
+
+#else
+
+#define STAT_ADD(c, n)        ((void)(n))
+#define STAT_TIME_START(v)    ((void)0)
+#define STAT_TIME_STOP(t, v)  ((void)0)
+#define STAT_POOL_DEPTH(d)    ((void)(d))
+
+#endif
+
+#endif
@@ -0,0 +1,260 @@
+#include "strtab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STR_CHUNK   (64 * 1024)
+#define STR_MIN_CAP 1024
+
+typedef struct {
+    const char **by_id;        /* handle -> string, NULL for gaps */
+    uint32_t     limit;        /* one past the largest handle */
+    uint32_t     id_cap;
+    StrId       *slots;        /* open addressing, 0 = empty */
+    uint32_t     cap;          /* power of two, kept at most half full */
+    uint32_t     used;
+    char       **chunks;       /* string bytes; never moved */
+    int          chunk_count;
+    size_t       chunk_used;
+} StrTab;
+
+static StrTab tab = { NULL, 1, 0, NULL, 0, 0, NULL, 0, STR_CHUNK };
+
+//FNV-1a
+static uint32_t str_hash(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    while (len--) h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+}
+
+static StrId *probe_in(StrId *slots, uint32_t cap, const char *const *by_id,
+                       const char *s, size_t len, uint32_t hash) {
+    uint32_t i = hash & (cap - 1);
+    while (slots[i] != STR_NONE) {
+        const char *k = by_id[slots[i]];
+        if (strncmp(k, s, len) == 0 && k[len] == '\0') break;
+        i = (i + 1) & (cap - 1);
+    }
+    return &slots[i];
+}
+
+static StrId *probe(StrId *slots, uint32_t cap, const char *s, size_t len,
+                    uint32_t hash) {
+    return probe_in(slots, cap, tab.by_id, s, len, hash);
+}
+
+static int grow_slots(void) {
+    uint32_t cap   = tab.cap ? tab.cap * 2 : STR_MIN_CAP;
+    StrId   *slots = calloc(cap, sizeof(StrId));
+    if (!slots) return 0;
+    for (uint32_t id = 1; id < tab.limit; id++) {
+        const char *k = tab.by_id[id];
+        if (!k) continue;
+        size_t len = strlen(k);
+        *probe(slots, cap, k, len, str_hash(k, len)) = id;
+    }
+    free(tab.slots);
+    tab.slots = slots;
+    tab.cap   = cap;
+    return 1;
+}
+
+static int reserve_id(uint32_t id) {
+    if (id < tab.id_cap) return 1;
+    uint32_t     cap   = tab.id_cap ? tab.id_cap : STR_MIN_CAP;
+    while (cap <= id) cap *= 2;
+    const char **by_id = realloc(tab.by_id, cap * sizeof(*by_id));
+    if (!by_id) return 0;
+    memset(by_id + tab.id_cap, 0, (cap - tab.id_cap) * sizeof(*by_id));
+    tab.by_id  = by_id;
+    tab.id_cap = cap;
+    return 1;
+}
+
+//copy of s in the newest chunk, starting a new one when it is full
+static const char *store(const char *s, size_t len) {
+    if (tab.chunk_used + len + 1 > STR_CHUNK) {
+        char **chunks = realloc(tab.chunks,
+                                (size_t)(tab.chunk_count + 1) *
+                                sizeof(*chunks));
+        if (!chunks) return NULL;
+        tab.chunks = chunks;
+        if (!(chunks[tab.chunk_count] = malloc(STR_CHUNK))) return NULL;
+        tab.chunk_count++;
+        tab.chunk_used = 0;
+    }
+    char *p = tab.chunks[tab.chunk_count - 1] + tab.chunk_used;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    tab.chunk_used += len + 1;
+    return p;
+}
+
+//file s under id; the caller has checked neither is taken
+static int add(StrId id, const char *s, size_t len, uint32_t hash) {
+    if ((tab.used + 1) * 2 > tab.cap && !grow_slots()) return 0;
+    if (!reserve_id(id)) return 0;
+    const char *copy = store(s, len);
+    if (!copy) return 0;
+    tab.by_id[id] = copy;
+    *probe(tab.slots, tab.cap, s, len, hash) = id;
+    tab.used++;
+    if (id >= tab.limit) tab.limit = id + 1;
+    return 1;
+}
+
+StrId str_intern(const char *s) {
+    size_t   len  = strlen(s);
+    uint32_t hash = str_hash(s, len);
+    if (len == 0) return STR_NONE;
+    if (tab.cap) {
+        StrId id = *probe(tab.slots, tab.cap, s, len, hash);
+        if (id != STR_NONE) return id;
+    }
+    StrId id = tab.limit;
+    if (!add(id, s, len, hash)) {
+        fprintf(stderr, "Error: out of memory interning \"%s\".\n", s);
+        return STR_NONE;
+    }
+    return id;
+}
+
+StrId str_find(const char *s) {
+    size_t len = strlen(s);
+    if (len == 0 || !tab.cap) return STR_NONE;
+    return *probe(tab.slots, tab.cap, s, len, str_hash(s, len));
+}
+
+const char *str_get(StrId id) {
+    if (id >= tab.limit || !tab.by_id[id]) return "";
+    return tab.by_id[id];
+}
+
+StrId str_limit(void) {
+    return tab.limit;
+}
+
+int str_load(StrId id, const char *s, size_t len) {
+    if (id == STR_NONE || len == 0 || memchr(s, '\0', len)) return 0;
+    uint32_t hash = str_hash(s, len);
+    StrId    have = tab.cap ? *probe(tab.slots, tab.cap, s, len, hash)
+                            : STR_NONE;
+    if (have != STR_NONE) return have == id;
+    if (id < tab.limit && tab.by_id[id]) return 0;
+    return add(id, s, len, hash);
+}
+
+//image: u32 count, u32 slot count, u64 byte count, then the handles
+//(ascending), each string's offset in the bytes, the hash slots and the
+//bytes, every string NUL terminated
+typedef struct {
+    uint32_t count;
+    uint32_t cap;
+    uint64_t bytes;
+} ImageHeader;
+
+int str_write_image(FILE *f, const char *const *strings, StrId limit) {
+    ImageHeader h = { 0, STR_MIN_CAP, 0 };
+    for (StrId id = 1; id < limit; id++) {
+        if (!strings[id]) continue;
+        h.count++;
+        h.bytes += strlen(strings[id]) + 1;
+    }
+    while (h.count > h.cap / 2) h.cap *= 2;
+
+    StrId    *ids   = malloc((h.count ? h.count : 1) * sizeof(StrId));
+    uint32_t *offs  = malloc((h.count ? h.count : 1) * sizeof(uint32_t));
+    StrId    *slots = calloc(h.cap, sizeof(StrId));
+    int       ok    = ids && offs && slots && h.bytes <= UINT32_MAX;
+    uint32_t  n     = 0;
+    uint64_t  at    = 0;
+    for (StrId id = 1; ok && id < limit; id++) {
+        if (!strings[id]) continue;
+        size_t len = strlen(strings[id]);
+        ids[n]  = id;
+        offs[n] = (uint32_t)at;
+        *probe_in(slots, h.cap, strings, strings[id], len,
+                  str_hash(strings[id], len)) = id;
+        at += len + 1;
+        n++;
+    }
+    ok = ok && fwrite(&h, sizeof(h), 1, f) == 1 &&
+         fwrite(ids, sizeof(StrId), h.count, f) == h.count &&
+         fwrite(offs, sizeof(uint32_t), h.count, f) == h.count &&
+         fwrite(slots, sizeof(StrId), h.cap, f) == h.cap;
+    for (n = 0; ok && n < h.count; n++)
+        ok = fwrite(strings[ids[n]], 1, strlen(strings[ids[n]]) + 1, f) ==
+             strlen(strings[ids[n]]) + 1;
+    free(ids);
+    free(offs);
+    free(slots);
+    return ok;
+}
+
+size_t str_read_image(const void *image, size_t len) {
+    const uint8_t *p = image;
+    ImageHeader    h;
+    if (tab.used || len < sizeof(h)) return 0;
+    memcpy(&h, p, sizeof(h));
+    if (h.cap < STR_MIN_CAP || (h.cap & (h.cap - 1)) ||
+        h.count > h.cap / 2 || h.bytes > UINT32_MAX || h.bytes < h.count ||
+        (len - sizeof(h)) / 4 < (uint64_t)h.count * 2 + h.cap ||
+        len - sizeof(h) - ((size_t)h.count * 2 + h.cap) * 4 < h.bytes)
+        return 0;
+
+    const StrId    *ids   = (const StrId *)(p + sizeof(h));
+    const uint32_t *offs  = ids + h.count;
+    const StrId    *slots = offs + h.count;
+    const char     *src   = (const char *)(slots + h.cap);
+    char           *bytes = malloc(h.bytes ? (size_t)h.bytes : 1);
+    char          **chunk = malloc(sizeof(*chunk));
+    tab.slots = malloc(h.cap * sizeof(StrId));
+    int ok = bytes && chunk && tab.slots &&
+             (h.bytes == 0 || src[h.bytes - 1] == '\0') &&
+             (h.count == 0 || reserve_id(ids[h.count - 1]));
+    if (ok) {
+        memcpy(bytes, src, (size_t)h.bytes);
+        memcpy(tab.slots, slots, h.cap * sizeof(StrId));
+    }
+    //handles climb, strings start where the one before ended
+    for (uint32_t n = 0; ok && n < h.count; n++) {
+        ok = ids[n] != STR_NONE && (n == 0 || ids[n] > ids[n - 1]) &&
+             offs[n] == (n == 0 ? 0 : offs[n - 1] +
+                                      strlen(bytes + offs[n - 1]) + 1) &&
+             offs[n] < h.bytes && bytes[offs[n]] != '\0';
+        if (ok) tab.by_id[ids[n]] = bytes + offs[n];
+    }
+    //and the slots only hold those handles, leaving probes room to stop
+    uint32_t filled = 0;
+    for (uint32_t i = 0; ok && i < h.cap; i++) {
+        if (tab.slots[i] == STR_NONE) continue;
+        ok = tab.slots[i] < tab.id_cap && tab.by_id[tab.slots[i]] &&
+             ++filled <= h.count;
+    }
+    if (!ok) {
+        free(bytes);
+        free(chunk);
+        str_free_all();
+        return 0;
+    }
+
+    //the bytes become one full chunk; new strings start a fresh one
+    chunk[0]        = bytes;
+    tab.chunks      = chunk;
+    tab.chunk_count = 1;
+    tab.chunk_used  = STR_CHUNK;
+    tab.cap         = h.cap;
+    tab.used        = h.count;
+    tab.limit       = h.count ? ids[h.count - 1] + 1 : 1;
+    return sizeof(h) + ((size_t)h.count * 2 + h.cap) * 4 + (size_t)h.bytes;
+}
+
+void str_free_all(void) {
+    for (int i = 0; i < tab.chunk_count; i++) free(tab.chunks[i]);
+    free(tab.chunks);
+    free(tab.by_id);
+    free(tab.slots);
+    memset(&tab, 0, sizeof(tab));
+    tab.limit      = 1;
+    tab.chunk_used = STR_CHUNK;
+}
@@ -0,0 +1,43 @@
+#ifndef STRTAB_H
+#define STRTAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+//interned strings: every student id, invoice id and reference is stored
+//once and transactions carry its 32-bit handle, so two ids are equal
+//exactly when their handles are. handles count up from 1; 0 is the empty
+//string. the table only grows and its strings never move, so a handle
+//and the pointer str_get returns stay valid for the life of the process.
+//one table is shared by everything in the process; like the chain and
+//the pool it is not locked, callers serialise access
+typedef uint32_t StrId;
+#define STR_NONE 0
+
+//handle for s, adding it if it is new; STR_NONE for "" or out of memory
+StrId       str_intern(const char *s);
+//handle for s if it has been seen, else STR_NONE; never adds
+StrId       str_find(const char *s);
+//the string behind id ("" for STR_NONE or an unknown handle)
+const char *str_get(StrId id);
+//one past the largest handle handed out
+StrId       str_limit(void);
+
+//put s back under the handle it had when it was saved (the chain log
+//stores the strings its blocks use with their handles). returns 0 if
+//that handle or that string is already taken by something else
+int         str_load(StrId id, const char *s, size_t len);
+
+//bulk form for state snapshots: the strings in strings[1..limit) that
+//are not NULL, with their handles and a ready-made hash table, so that
+//reading them back costs no hashing. reading takes an image in memory
+//(4-byte aligned) and needs an empty table; it returns the image's
+//length, or 0 with the table left empty if it is short or damaged
+int         str_write_image(FILE *f, const char *const *strings,
+                            StrId limit);
+size_t      str_read_image(const void *image, size_t len);
+
+void        str_free_all(void);
+
+#endif
@@ -0,0 +1,91 @@
+//the first data/chain.bin, from before the chain log, loaded the way the
+//program imports it: blockchain_load has to bring back its four blocks
+//with the amounts as exact hundredths, and after mine_reseal_chain every
+//block has to link to the one before and meet its target again
+//usage: test_import [chain.bin]
+#include "blockchain.h"
+#include "miner.h"
+#include "strtab.h"
+#include <stdio.h>
+#include <string.h>
+
+static const struct {
+    int         height;
+    int         type;
+    const char *student;
+    const char *invoice;
+    int64_t     amount;
+    int64_t     balance;
+} expected[] = {
+    { 1, TX_INVOICE_CREATE, "alu10",   "000",     2000,  2000  },
+    { 2, TX_INVOICE_CREATE, "STU-001", "INV-001", 40000, 40000 },
+    { 3, TX_PAYMENT_MADE,   "STU-001", "INV-001", 10000, 30000 },
+};
+
+#define EXPECTED (sizeof(expected) / sizeof(expected[0]))
+
+static int check_txs(const Blockchain *bc, const char *when) {
+    int ok = 1;
+    for (size_t i = 0; i < EXPECTED; i++) {
+        const Block       *b = blockchain_block(bc, expected[i].height);
+        const Transaction *t = &b->transactions[0];
+        if (b->tx_count != 1 || t->type != expected[i].type ||
+            strcmp(str_get(t->student), expected[i].student) != 0 ||
+            strcmp(str_get(t->invoice), expected[i].invoice) != 0 ||
+            t->amount != expected[i].amount ||
+            t->balance != expected[i].balance) {
+            printf("FAIL block %d (%s): %d tx(s), type %d, %s/%s, "
+                   "%lld/%lld\n", expected[i].height, when, b->tx_count,
+                   t->type, str_get(t->student), str_get(t->invoice),
+                   (long long)t->amount, (long long)t->balance);
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+//what blockchain_verify checks, without its report
+static int check_sealed(const Blockchain *bc) {
+    int ok = 1;
+    for (int i = 0; i < bc->length; i++) {
+        const Block *b = blockchain_block(bc, i);
+        char         hash[HASH_HEX_LEN];
+        compute_block_hash(b, hash);
+        if (strcmp(hash, b->hash) != 0 || !block_merkle_ok(b) ||
+            !hex_meets_target(b->hash, (int)b->target_bits) ||
+            (i > 0 && strcmp(b->prev_hash,
+                             blockchain_block(bc, i - 1)->hash) != 0)) {
+            printf("FAIL block %d is not sealed after the import\n", i);
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = argc > 1 ? argv[1] : "data/chain.bin";
+    Blockchain  bc;
+
+    int r = blockchain_load(&bc, path);
+    if (r != 2) {
+        printf("FAIL %s: blockchain_load returned %d, want 2\n", path, r);
+        return 1;
+    }
+    int ok = 1;
+    if (bc.length != 4 || bc.difficulty != 8 || bc.block_txs != 8) {
+        printf("FAIL %s: %d block(s), %d bits, %d tx(s) a block; want 4, "
+               "8 and 8\n", path, bc.length, bc.difficulty, bc.block_txs);
+        ok = 0;
+    }
+    ok = ok && check_txs(&bc, "loaded");
+
+    if (ok && mine_reseal_chain(&bc) < 0) {
+        printf("FAIL mine_reseal_chain ran out of memory\n");
+        ok = 0;
+    }
+    ok = ok && check_txs(&bc, "resealed") && check_sealed(&bc);
+
+    printf("import    chain.bin %s\n", ok ? "ok" : "FAILED");
+    blockchain_free(&bc);
+    return !ok;
+}
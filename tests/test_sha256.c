@@ -0,0 +1,101 @@
+//single-stream SHA-256 against the NIST FIPS 180-2 example vectors, on
+//the portable path and on SHA-NI when the cpu has it: each message in
+//one update and split at odd offsets, so that both the buffered tail
+//and the whole-chunk bulk path of sha256_update see it
+#include "sha256.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MILLION 1000000
+
+static const struct {
+    const char *name;
+    const char *msg;      /* NULL: a million 'a' */
+    const char *digest;
+} vectors[] = {
+    { "empty", "",
+      "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    { "abc", "abc",
+      "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { "448-bit",
+      "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+    { "896-bit",
+      "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+      "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+      "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+    { "million a", NULL,
+      "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" }
+};
+
+//piece sizes for the split runs, cycled: around and across chunk edges
+static const size_t pieces[] = { 1, 3, 63, 65, 7, 129, 61, 200, 5, 1021 };
+
+static int check(const char *impl, const char *name, const char *how,
+                 SHA256_CTX *ctx, const char *want) {
+    uint8_t digest[32];
+    char    got[65];
+    sha256_final(ctx, digest);
+    sha256_digest_hex(digest, got);
+    if (strcmp(got, want) == 0) return 1;
+    printf("FAIL %s (%s, %s): %s, want %s\n", name, impl, how, got, want);
+    return 0;
+}
+
+static int run(const char *impl, const uint8_t *million) {
+    int ok = 1;
+    for (size_t v = 0; v < sizeof(vectors) / sizeof(vectors[0]); v++) {
+        const uint8_t *msg = vectors[v].msg ? (const uint8_t *)vectors[v].msg
+                                            : million;
+        size_t len = vectors[v].msg ? strlen(vectors[v].msg) : MILLION;
+        SHA256_CTX ctx;
+
+        sha256_init(&ctx);
+        sha256_update(&ctx, msg, len);
+        ok &= check(impl, vectors[v].name, "whole", &ctx, vectors[v].digest);
+
+        //every starting piece, so short messages get split everywhere
+        for (size_t s = 0; s < sizeof(pieces) / sizeof(pieces[0]); s++) {
+            sha256_init(&ctx);
+            for (size_t at = 0, i = s; at < len; i++) {
+                size_t n = pieces[i % (sizeof(pieces) / sizeof(pieces[0]))];
+                if (n > len - at) n = len - at;
+                sha256_update(&ctx, msg + at, n);
+                at += n;
+            }
+            ok &= check(impl, vectors[v].name, "split", &ctx,
+                        vectors[v].digest);
+        }
+
+        //and sha256_hex, which is what the rest of the program calls
+        char hex[65];
+        sha256_hex(msg, len, hex);
+        if (strcmp(hex, vectors[v].digest) != 0) {
+            printf("FAIL %s (%s, sha256_hex): %s, want %s\n",
+                   vectors[v].name, impl, hex, vectors[v].digest);
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+int main(void) {
+    static const char *const impls[] = { "portable", "sha-ni" };
+    uint8_t *million = malloc(MILLION);
+    if (!million) return 1;
+    memset(million, 'a', MILLION);
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (!sha256_select(impls[i])) {
+            printf("sha256    %-8s skipped, not supported here\n", impls[i]);
+            continue;
+        }
+        int ok = run(impls[i], million);
+        printf("sha256    %-8s %s\n", impls[i], ok ? "ok" : "FAILED");
+        failed |= !ok;
+    }
+    free(million);
+    return failed;
+}
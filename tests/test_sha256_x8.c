@@ -0,0 +1,105 @@
+//multi-buffer SHA-256 against the single-stream one: sha256_x8 and
+//sha256_x8_midstate on every kernel this cpu can run, with random
+//messages of 0-300 bytes in 1 to 8 lanes
+//usage: test_sha256_x8 [rounds] [seed]
+#include "sha256.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LEN 300
+
+static uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void fill(uint8_t *p, size_t n) {
+    for (size_t i = 0; i < n; i++) p[i] = (uint8_t)rng_next();
+}
+
+static int check(const char *what, const char *impl, const uint8_t *msg,
+                 size_t len, const uint8_t digest[32]) {
+    char want[65], got[65];
+    sha256_hex(msg, len, want);
+    sha256_digest_hex(digest, got);
+    if (strcmp(want, got) == 0) return 1;
+    printf("FAIL %s (%s) on %zu byte(s): %s, want %s\n", what, impl, len,
+           got, want);
+    return 0;
+}
+
+//k independent messages of random length
+static int round_x8(const char *impl, int k) {
+    static uint8_t buf[SHA256_LANES][MAX_LEN];
+    const uint8_t *msgs[SHA256_LANES];
+    size_t         lens[SHA256_LANES];
+    uint8_t        digests[SHA256_LANES][32];
+    int            ok = 1;
+
+    for (int l = 0; l < k; l++) {
+        lens[l] = (size_t)(rng_next() % (MAX_LEN + 1));
+        fill(buf[l], lens[l]);
+        msgs[l] = buf[l];
+    }
+    sha256_x8(msgs, lens, k, digests);
+    for (int l = 0; l < k; l++)
+        ok &= check("sha256_x8", impl, msgs[l], lens[l], digests[l]);
+    return ok;
+}
+
+//k tails of one random length after a shared prefix, which is a whole
+//number of chunks for the lane path and any length for the fallback
+static int round_midstate(const char *impl, int k) {
+    static uint8_t buf[SHA256_LANES][2 * MAX_LEN];
+    const uint8_t *tails[SHA256_LANES];
+    uint8_t        digests[SHA256_LANES][32];
+    SHA256_CTX     mid;
+    size_t         prefix = (size_t)(rng_next() % (MAX_LEN + 1));
+    size_t         tail   = (size_t)(rng_next() % (MAX_LEN + 1));
+    int            ok     = 1;
+
+    if (rng_next() % 4) prefix -= prefix % 64;
+    fill(buf[0], prefix + tail);
+    for (int l = 1; l < k; l++) {
+        memcpy(buf[l], buf[0], prefix);
+        fill(buf[l] + prefix, tail);
+    }
+    for (int l = 0; l < k; l++) tails[l] = buf[l] + prefix;
+
+    sha256_init(&mid);
+    sha256_update(&mid, buf[0], prefix);
+    sha256_x8_midstate(&mid, tails, tail, k, digests);
+    for (int l = 0; l < k; l++)
+        ok &= check("sha256_x8_midstate", impl, buf[l], prefix + tail,
+                    digests[l]);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    static const char *const impls[] = { "scalar", "sse4.1", "avx2" };
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    rng_state  = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+
+    //the reference stays the same whatever the cpu
+    sha256_select("portable");
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (!sha256_x8_select(impls[i])) {
+            printf("sha256_x8 %-8s skipped, not supported here\n", impls[i]);
+            continue;
+        }
+        int ok = 1;
+        for (int r = 0; r < rounds; r++)
+            for (int k = 1; k <= SHA256_LANES; k++)
+                ok &= round_x8(impls[i], k) & round_midstate(impls[i], k);
+        printf("sha256_x8 %-8s %s\n", impls[i], ok ? "ok" : "FAILED");
+        failed |= !ok;
+    }
+    return failed;
+}
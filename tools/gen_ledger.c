@@ -0,0 +1,437 @@
+//synthetic ledger: invoices, payments, confirmations and settlements for
+//a made-up school, queued in the pool and mined into blocks the way the
+//menu would record them, then written out as a chain log and a pending
+//log the program opens like its own. the same seed and profile give the
+//same events in the same order; only the times move, since the history
+//is laid out to end when it is generated
+//usage: gen_ledger [options] [out dir, default data]
+//  --seed N          random seed (1)
+//  --students N      students (1000)
+//  --invoices N      mean invoices per student (3)
+//  --profile P       payment counts: skewed, most invoices paid at once
+//                    and a few in many instalments, or uniform (skewed)
+//  --max-payments N  most payments on one invoice (12)
+//  --settled PCT     invoices paid in full (70)
+//  --partial PCT     invoices paid in part; the rest get nothing (20)
+//  --confirmed PCT   payments that get confirmed (90)
+//  --bits N          proof of work per block, 1 is the least (1)
+//  --block-size N    transactions per block (64)
+//  --pending N       leave up to N transactions unmined in the pool (0)
+//  --force           replace a chain already in the out dir
+#define _POSIX_C_SOURCE 200809L
+
+#include "blockchain.h"
+#include "chainlog.h"
+#include "miner.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+//mean seconds between two events
+#define EVENT_GAP_S 2
+
+typedef enum { PROFILE_SKEWED, PROFILE_UNIFORM } Profile;
+
+typedef struct {
+    uint64_t seed;
+    int      students;
+    int      invoices;
+    Profile  profile;
+    int      max_payments;
+    int      settled;
+    int      partial;
+    int      confirmed;
+    int      bits;
+    int      block_txs;
+    int      pending;
+    int      force;
+    const char *dir;
+} GenConfig;
+
+//one invoice's plan: paid is what it will have received once its last
+//payment is in, spread over payments instalments
+typedef struct {
+    StrId   student;
+    StrId   invoice;
+    int64_t amount;
+    int64_t balance;
+    int64_t paid;
+    int     payments;
+    int     made;       /* -1 until the invoice is created */
+} GenInvoice;
+
+//a payment to be confirmed once it is mined; seq is its place in the
+//pool's order (TxPool.taken counts past it once it is in a block)
+typedef struct {
+    uint32_t    seq;
+    Transaction pay;
+} Awaiting;
+
+typedef struct {
+    int events[4];      /* by TxType */
+    int blocks;
+} GenStats;
+
+static uint64_t rng_state;
+
+//splitmix64: small, fast and the same everywhere
+static uint64_t rng_next(void) {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+//uniform in [0, n)
+static uint64_t rng_below(uint64_t n) {
+    return n ? rng_next() % n : 0;
+}
+
+static int rng_percent(int pct) {
+    return (int)rng_below(100) < pct;
+}
+
+static int payment_count(const GenConfig *cfg) {
+    if (cfg->profile == PROFILE_UNIFORM)
+        return 1 + (int)rng_below((uint64_t)cfg->max_payments);
+    //each further instalment half as likely as the one before
+    int k = 1;
+    while (k < cfg->max_payments && rng_below(2)) k++;
+    return k;
+}
+
+//amounts in whole francs (minor units of 100): 50,000 to 2,000,000 an
+//invoice, partial payers get 10-90% of it in
+static GenInvoice *plan(const GenConfig *cfg, int *count, long *events) {
+    char        id[MAX_INVOICE_ID];
+    int         cap  = 0, n = 0;
+    long        pays = 0;
+    GenInvoice *invs = NULL;
+
+    for (int s = 0; s < cfg->students; s++) {
+        snprintf(id, sizeof(id), "STU%06d", s);
+        StrId student = str_intern(id);
+        int   k = 1 + (int)rng_below((uint64_t)cfg->invoices * 2 - 1);
+        for (int j = 0; j < k; j++) {
+            if (n == cap) {
+                cap  = cap ? cap * 2 : 1024;
+                invs = realloc(invs, (size_t)cap * sizeof(*invs));
+                if (!invs) {
+                    fprintf(stderr, "Error: out of memory planning "
+                                    "invoices.\n");
+                    exit(1);
+                }
+            }
+            GenInvoice *v = &invs[n];
+            memset(v, 0, sizeof(*v));
+            snprintf(id, sizeof(id), "INV%08d", n);
+            v->student = student;
+            v->invoice = str_intern(id);
+            v->amount  = (int64_t)(50000 + rng_below(1950001)) * 100;
+            v->balance = v->amount;
+            v->made    = -1;
+
+            int r = (int)rng_below(100);
+            if (r < cfg->settled) {
+                v->paid = v->amount;
+            } else if (r < cfg->settled + cfg->partial) {
+                v->paid = v->amount / 100 * (int64_t)(10 + rng_below(81));
+            }
+            if (v->paid > 0) {
+                v->payments = payment_count(cfg);
+                if (v->payments > v->paid) v->payments = (int)v->paid;
+            }
+            pays += v->payments;
+            n++;
+        }
+    }
+    //a creation, the payments, their confirmations and a settlement
+    *events = 2L * n + pays + pays * cfg->confirmed / 100;
+    *count  = n;
+    return invs;
+}
+
+//the next instalment: an even share give or take half, the last one
+//whatever is left
+static int64_t instalment(GenInvoice *v) {
+    int64_t left  = v->paid - (v->amount - v->balance);
+    int     to_go = v->payments - v->made;
+    if (to_go <= 1) return left;
+    int64_t share = left / to_go;
+    int64_t part  = share / 2 + (int64_t)rng_below((uint64_t)share + 1);
+    //every later instalment still gets at least one unit
+    if (part > left - (to_go - 1)) part = left - (to_go - 1);
+    return part > 0 ? part : 1;
+}
+
+static time_t sim_now;
+
+static void queue(TxPool *p, Transaction *tx, GenStats *st) {
+    sim_now += (time_t)rng_below(2 * EVENT_GAP_S + 1);
+    tx->event_time = sim_now;
+    if (!pool_add(p, tx)) {
+        fprintf(stderr, "Error: out of memory growing the pool.\n");
+        exit(1);
+    }
+    st->events[tx->type]++;
+}
+
+//seals the oldest take pending transactions into a block stamped with
+//the simulated clock, mines it and appends it to the log
+static void seal(Blockchain *bc, TxPool *p, Block *b, ChainLog *log,
+                 int take, GenStats *st) {
+    int full = bc->block_txs;
+    //pool_flush_to_block fills up to the chain's block size
+    bc->block_txs = take;
+    pool_flush_to_block(p, b, bc);
+    bc->block_txs = full;
+    b->timestamp = sim_now;
+    block_set_merkle_root(b);
+    mine_block(b, (int)b->target_bits);
+    if (!blockchain_add_mined_block(bc, b) || !chainlog_append(log, b))
+        exit(1);
+    st->blocks++;
+}
+
+//confirmations of payments that made it into a block, and the
+//settlement the menu queues when one leaves nothing owing
+static void confirm_mined(TxPool *p, Awaiting *aw, int *head, int tail,
+                          GenStats *st) {
+    for (; *head < tail && aw[*head].seq < p->taken; (*head)++) {
+        const Transaction *pay = &aw[*head].pay;
+        Transaction        tx  = *pay;
+        tx.type      = TX_PAYMENT_CONFIRM;
+        tx.confirmed = 1;
+        queue(p, &tx, st);
+        if (pay->balance == 0) {
+            memset(&tx, 0, sizeof(tx));
+            tx.type      = TX_INVOICE_SETTLE;
+            tx.confirmed = 1;
+            tx.invoice   = pay->invoice;
+            tx.student   = pay->student;
+            tx.reference = str_intern("AUTO-SETTLE");
+            queue(p, &tx, st);
+        }
+    }
+}
+
+static int generate(const GenConfig *cfg, const char *chain_path,
+                    const char *pool_path, GenStats *st) {
+    Blockchain  bc;
+    TxPool      pool;
+    ChainLog    chain_log;
+    PoolLog     pool_log;
+    MinerConfig mcfg;
+    Transaction tx;
+    char        ref[MAX_REF];
+    int         count;
+    long        events;
+
+    memset(st, 0, sizeof(*st));
+    rng_state = cfg->seed;
+    GenInvoice *invs = plan(cfg, &count, &events);
+    int        *live = malloc((size_t)count * sizeof(*live));
+    Awaiting   *aw   = malloc((size_t)(events + 1) * sizeof(*aw));
+    if (!live || !aw) {
+        fprintf(stderr, "Error: out of memory planning invoices.\n");
+        exit(1);
+    }
+
+    //one thread: a block at low difficulty takes less than starting more
+    miner_config_default(&mcfg);
+    mcfg.threads = 1;
+    mcfg.quiet   = 1;
+    mcfg.report  = 0;
+    miner_set_config(&mcfg);
+
+    //a genesis block from when the history starts
+    sim_now = time(NULL) - (time_t)events * EVENT_GAP_S;
+    blockchain_init(&bc, cfg->bits);
+    blockchain_set_block_txs(&bc, cfg->block_txs);
+    blockchain_free(&bc);
+    Block *b = block_new(bc.block_txs);
+    if (!b) exit(1);
+    memset(b->prev_hash, '0', 64);
+    b->timestamp   = sim_now;
+    b->target_bits = (uint32_t)bc.difficulty;
+    block_set_merkle_root(b);
+    mine_block(b, bc.difficulty);
+    if (!blockchain_push(&bc, b) ||
+        !chainlog_create(&chain_log, chain_path, &bc, DEFAULT_SYNC_MS))
+        exit(1);
+    pool_init(&pool, 0);
+
+    //every step picks an invoice at random and records its next event,
+    //so creations, instalments and confirmations interleave
+    int nlive = count, head = 0, tail = 0;
+    for (int i = 0; i < count; i++) live[i] = i;
+    while (nlive > 0) {
+        int         at = (int)rng_below((uint64_t)nlive);
+        GenInvoice *v  = &invs[live[at]];
+
+        memset(&tx, 0, sizeof(tx));
+        tx.student = v->student;
+        tx.invoice = v->invoice;
+        if (v->made < 0) {
+            tx.type      = TX_INVOICE_CREATE;
+            tx.amount    = tx.balance = v->amount;
+            tx.confirmed = 1;
+            tx.reference = str_intern("ALU Tuition Invoice");
+        } else {
+            tx.type    = TX_PAYMENT_MADE;
+            tx.amount  = instalment(v);
+            tx.balance = v->balance -= tx.amount;
+            snprintf(ref, sizeof(ref), "BK-%08d-%d", live[at], v->made + 1);
+            tx.reference = str_intern(ref);
+        }
+        if (tx.type == TX_PAYMENT_MADE && rng_percent(cfg->confirmed)) {
+            aw[tail].seq   = pool.taken + (uint32_t)pool.count;
+            aw[tail++].pay = tx;
+        }
+        queue(&pool, &tx, st);
+        if (++v->made >= v->payments) live[at] = live[--nlive];
+
+        confirm_mined(&pool, aw, &head, tail, st);
+        while (pool.count >= bc.block_txs)
+            seal(&bc, &pool, b, &chain_log, bc.block_txs, st);
+    }
+
+    //mine down to the pending transactions, confirming what gets mined
+    //on the way; a payment still pending is confirmed where it waits,
+    //as the menu does
+    while (pool.count > cfg->pending) {
+        int take = pool.count - cfg->pending;
+        seal(&bc, &pool, b, &chain_log,
+             take < bc.block_txs ? take : bc.block_txs, st);
+        confirm_mined(&pool, aw, &head, tail, st);
+    }
+    for (; head < tail; head++)
+        pool_tx(&pool, (int)(aw[head].seq - pool.taken))->confirmed = 1;
+
+    //the pool log starts empty at this height, then takes the pool
+    TxPool empty;
+    pool_init(&empty, 0);
+    int ok = poollog_open(&pool_log, pool_path, &empty, &bc,
+                          DEFAULT_SYNC_MS) &&
+             poollog_add_batch(&pool_log, &pool, 0, pool.count);
+    poollog_close(&pool_log);
+    chainlog_close(&chain_log);
+    pool_free(&empty);
+
+    printf("%d students, %d invoices: %d created, %d payments, "
+           "%d confirmations, %d settlements\n",
+           cfg->students, count, st->events[TX_INVOICE_CREATE],
+           st->events[TX_PAYMENT_MADE], st->events[TX_PAYMENT_CONFIRM],
+           st->events[TX_INVOICE_SETTLE]);
+    printf("%d blocks mined at %d bits, %d transaction(s) pending\n",
+           bc.length, bc.difficulty, pool.count);
+
+    free(b);
+    free(aw);
+    free(live);
+    free(invs);
+    pool_free(&pool);
+    blockchain_free(&bc);
+    return ok;
+}
+
+static int percent(const char *s) {
+    int n = atoi(s);
+    return n < 0 ? 0 : n > 100 ? 100 : n;
+}
+
+int main(int argc, char *argv[]) {
+    GenConfig cfg = { 1, 1000, 3, PROFILE_SKEWED, 12, 70, 20, 90,
+                      MIN_TARGET_BITS, DEFAULT_BLOCK_TXS, 0, 0, "data" };
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        if (strcmp(opt, "--force") == 0) {
+            cfg.force = 1;
+        } else if (strncmp(opt, "--", 2) != 0) {
+            cfg.dir = opt;
+        } else if (i + 1 >= argc) {
+            fprintf(stderr, "Error: %s needs a value.\n", opt);
+            return 2;
+        } else if (strcmp(opt, "--seed") == 0) {
+            cfg.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(opt, "--students") == 0) {
+            cfg.students = atoi(argv[++i]);
+        } else if (strcmp(opt, "--invoices") == 0) {
+            cfg.invoices = atoi(argv[++i]);
+        } else if (strcmp(opt, "--profile") == 0) {
+            const char *p = argv[++i];
+            if (strcmp(p, "skewed") == 0) {
+                cfg.profile = PROFILE_SKEWED;
+            } else if (strcmp(p, "uniform") == 0) {
+                cfg.profile = PROFILE_UNIFORM;
+            } else {
+                fprintf(stderr, "Error: unknown profile %s.\n", p);
+                return 2;
+            }
+        } else if (strcmp(opt, "--max-payments") == 0) {
+            cfg.max_payments = atoi(argv[++i]);
+        } else if (strcmp(opt, "--settled") == 0) {
+            cfg.settled = percent(argv[++i]);
+        } else if (strcmp(opt, "--partial") == 0) {
+            cfg.partial = percent(argv[++i]);
+        } else if (strcmp(opt, "--confirmed") == 0) {
+            cfg.confirmed = percent(argv[++i]);
+        } else if (strcmp(opt, "--bits") == 0) {
+            cfg.bits = atoi(argv[++i]);
+        } else if (strcmp(opt, "--block-size") == 0) {
+            cfg.block_txs = atoi(argv[++i]);
+        } else if (strcmp(opt, "--pending") == 0) {
+            cfg.pending = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Error: unknown option %s.\n", opt);
+            return 2;
+        }
+    }
+    if (cfg.students < 1 || cfg.invoices < 1 || cfg.max_payments < 1 ||
+        cfg.pending < 0 || cfg.settled + cfg.partial > 100 ||
+        cfg.bits < MIN_TARGET_BITS || cfg.bits > MAX_TARGET_BITS ||
+        cfg.block_txs < 1 || cfg.block_txs > MAX_BLOCK_TXS) {
+        fprintf(stderr, "Error: a count is out of range, or --settled "
+                        "and --partial add up to more than 100.\n");
+        return 2;
+    }
+
+    char chain_path[256], pool_path[256], path[256];
+    snprintf(chain_path, sizeof(chain_path), "%s/chain.log", cfg.dir);
+    snprintf(pool_path, sizeof(pool_path), "%s/pending.wal", cfg.dir);
+    if (mkdir(cfg.dir, 0755) != 0 && errno != EEXIST) {
+        perror(cfg.dir);
+        return 1;
+    }
+    FILE *f = fopen(chain_path, "rb");
+    if (f) {
+        fclose(f);
+        if (!cfg.force) {
+            fprintf(stderr, "Error: %s already exists; pass --force to "
+                            "replace it.\n", chain_path);
+            return 1;
+        }
+    }
+    //files derived from an older chain
+    static const char *const stale[] = {
+        "chain.log.idx", "pending.wal", "chain.verified", "state.snap"
+    };
+    for (size_t i = 0; i < sizeof(stale) / sizeof(stale[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", cfg.dir, stale[i]);
+        remove(path);
+    }
+
+    GenStats st;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int ok = generate(&cfg, chain_path, pool_path, &st);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("wrote %s and %s in %.2f s\n", chain_path, pool_path,
+           (double)(t1.tv_sec - t0.tv_sec) +
+               (double)(t1.tv_nsec - t0.tv_nsec) / 1e9);
+    str_free_all();
+    return ok ? 0 : 1;
+}